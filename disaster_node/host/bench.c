@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "kalman_bank.h"
+#include "kalman_core.h"
+#include "kalman_port.h"
+#include "port.h"
+
+/*
+* Kalman filter benchmark for the host build. Feeds the filter the same
+* alternating ranging/ultrasonic stream the node sees at rest and reports the
+* time and heap allocations per update (one kalman_step()) and per
+* prediction, for the update mode the core was configured with. Then times a
+* kalman_bank tracking targets nodes, per target for each observe, predict
+* and update cycle.
+*
+* usage: kalman_bench [updates [targets]]
+*/
+#define DEFAULT_UPDATES 1000000
+#define WARMUP_UPDATES 1000
+// spacing of the simulated sensor messages (us)
+#define SAMPLE_PERIOD_US 50000
+
+// fixed-seed uniform noise in [-amplitude, amplitude] so runs are comparable
+static double noise(uint32_t* seed, double amplitude)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return amplitude * ((double)(*seed >> 8) / (1 << 24) * 2 - 1);
+}
+
+// a noisy reading around 1 m, in the integer um the sensor thread sends
+static int32_t reading_um(uint32_t* seed)
+{
+    return (int32_t)((1 + noise(seed, 0.01)) * KALMAN_MICRO);
+}
+
+// same model and noise as the node's filter thread
+static void bench_init(Kalman* filter)
+{
+    const int32_t x_init[4] = {KALMAN_MICRO, KALMAN_MICRO, KALMAN_MICRO, KALMAN_MICRO};
+
+    init_kalman(filter, 4, x_init, 10 * KALMAN_MICRO, 10000, 1000 * KALMAN_MICRO,
+        1000 * KALMAN_MICRO, 10000, 300000, KALMAN_TICKS_PER_SEC, 2, 4);
+}
+
+// current estimate in m and m/s; the fixed-point core only hands out
+// integers, so the host reads its Q16.16 state directly
+static void read_estimate(const Kalman* filter, vec4 x)
+{
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    for (int i = 0; i < 4; i++) {
+        x[i] = fix16_to(filter->fx_x[i]);
+    }
+#else
+    kalman_estimate(filter, x);
+#endif
+}
+
+// run count updates, returns the elapsed time in nanoseconds
+static uint64_t run_updates(Kalman* filter, long count, uint32_t* seed, int64_t* now, int64_t* last_ticks)
+{
+    kalman_obs obs;
+    uint64_t start = port_now_ns();
+
+    kalman_observe_init(obs, KALMAN_MICRO, KALMAN_MICRO);
+    for (long i = 0; i < count; i++) {
+        *now += SAMPLE_PERIOD_US;
+        uint8_t rows = kalman_observe(reading_um(seed), reading_um(seed), i & 1, obs);
+        kalman_set_dt_ticks(filter, kalman_elapsed_ticks(last_ticks, *now));
+        kalman_step(obs, rows, filter);
+    }
+    return port_now_ns() - start;
+}
+
+// run cycles observe, predict and update cycles over every target in bank,
+// returns the elapsed time in nanoseconds
+static uint64_t run_bank(struct kalman_bank* bank, int targets, long cycles, uint32_t* seed)
+{
+    uint64_t start = port_now_ns();
+
+    for (long i = 0; i < cycles; i++) {
+        // node ids are sparse, so every observation goes through the index
+        for (int id = 0; id < targets; id++) {
+            kalman_bank_observe(bank, id * 7919u, 1 + noise(seed, 0.01), 1 + noise(seed, 0.01));
+        }
+        kalman_bank_predict(bank, SAMPLE_PERIOD_US / 1e6);
+        kalman_bank_update(bank);
+    }
+    return port_now_ns() - start;
+}
+
+int main(int argc, char** argv)
+{
+    static Kalman kalman;
+    static struct kalman_bank bank;
+    long updates = (argc > 1) ? atol(argv[1]) : DEFAULT_UPDATES;
+    int targets = (argc > 2) ? atoi(argv[2]) : KALMAN_BANK_SIZE;
+    uint32_t seed = 1;
+    int64_t now = 0;
+    int64_t last_ticks = 0;
+
+    if (updates <= 0 || targets <= 0 || targets > KALMAN_BANK_SIZE) {
+        fprintf(stderr, "usage: %s [updates [targets, at most %d]]\n", argv[0], KALMAN_BANK_SIZE);
+        return 1;
+    }
+    bench_init(&kalman);
+    run_updates(&kalman, WARMUP_UPDATES, &seed, &now, &last_ticks);
+
+    uint64_t allocations = port_allocations();
+    uint64_t update_ns = run_updates(&kalman, updates, &seed, &now, &last_ticks);
+    uint64_t update_allocations = port_allocations() - allocations;
+    vec4 estimate;
+    vec4 predicted;
+    read_estimate(&kalman, estimate);
+
+    allocations = port_allocations();
+    uint64_t start = port_now_ns();
+    for (long i = 0; i < updates; i++) {
+        kalman_predict(&kalman);
+    }
+    uint64_t predict_ns = port_now_ns() - start;
+    uint64_t predict_allocations = port_allocations() - allocations;
+    read_estimate(&kalman, predicted);
+
+    kalman_bank_init(&bank, 0.3, 0.01);
+    for (int id = 0; id < targets; id++) {
+        kalman_bank_add(&bank, id * 7919u, 1, 1, 10);
+    }
+    long cycles = (updates + targets - 1) / targets;
+    run_bank(&bank, targets, WARMUP_UPDATES, &seed);
+    allocations = port_allocations();
+    uint64_t bank_ns = run_bank(&bank, targets, cycles, &seed);
+    uint64_t bank_allocations = port_allocations() - allocations;
+
+    printf("mode: %s\n", KALMAN_HOST_MODE);
+    printf("updates: %ld\n", updates);
+    printf("ns/update: %.1f\n", (double)update_ns / updates);
+    printf("allocations/update: %.3f\n", (double)update_allocations / updates);
+    printf("ns/predict: %.1f\n", (double)predict_ns / updates);
+    printf("allocations/predict: %.3f\n", (double)predict_allocations / updates);
+    printf("bank targets: %d\n", targets);
+    printf("bank ns/target: %.1f\n", (double)bank_ns / (cycles * targets));
+    printf("bank allocations/cycle: %.3f\n", (double)bank_allocations / cycles);
+    // keeps the results live so the loops are not optimized away
+    printf("estimate: %f %f, predicted: %f %f, bank: %f\n", estimate[0], estimate[1],
+        predicted[0], predicted[1], (double)bank.pos[KALMAN_BANK_X][0]);
+    return (update_allocations || predict_allocations || bank_allocations) ? 2 : 0;
+}
@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "mpu6050.h"
+
+/*
+* Host test of the MPU6050 FIFO path in library/mpu6050.c, against a
+* simulated part: a register file plus a FIFO that reports its byte count
+* the way the MPU6050 does, saturating at MPU6050_FIFO_SIZE. Checks the
+* divider, low pass filter and period set up for a range of rates, that
+* blocks are read and byte-swapped whole with the rest left pending, and
+* that a full FIFO or one holding a partial sample is reset.
+*
+* usage: mpu6050_fifo
+*/
+#define BLOCK_SAMPLES 32
+
+static uint8_t regs[128];
+static uint8_t fifo[2 * MPU6050_FIFO_SIZE];
+static int fifo_bytes;
+static int failures;
+
+int i2c_reg_write_byte_dt(const struct i2c_dt_spec* spec, uint8_t reg, uint8_t value)
+{
+    (void)spec;
+    regs[reg] = value;
+    if (reg == MPU6050_USER_CTRL && (value & MPU6050_USER_CTRL_FIFO_RESET)) {
+        fifo_bytes = 0;
+    }
+    return 0;
+}
+
+int i2c_reg_read_byte_dt(const struct i2c_dt_spec* spec, uint8_t reg, uint8_t* value)
+{
+    (void)spec;
+    *value = regs[reg];
+    return 0;
+}
+
+int i2c_burst_read_dt(const struct i2c_dt_spec* spec, uint8_t reg, uint8_t* buf, uint32_t len)
+{
+    (void)spec;
+    if (reg == MPU6050_FIFO_COUNTH && len == 2) {
+        int count = MIN(fifo_bytes, MPU6050_FIFO_SIZE);
+        buf[0] = count >> 8;
+        buf[1] = count & 0xff;
+        return 0;
+    }
+    if (reg == MPU6050_FIFO_R_W && len <= (uint32_t)fifo_bytes) {
+        memcpy(buf, fifo, len);
+        fifo_bytes -= len;
+        memmove(fifo, fifo + len, fifo_bytes);
+        return 0;
+    }
+    return -EIO;
+}
+
+// queue one sample the way the part stores it, big-endian x, y, z
+static void fifo_push(int16_t x, int16_t y, int16_t z)
+{
+    const int16_t sample[3] = {x, y, z};
+
+    for (int axis = 0; axis < 3; axis++) {
+        fifo[fifo_bytes++] = (uint16_t)sample[axis] >> 8;
+        fifo[fifo_bytes++] = (uint16_t)sample[axis] & 0xff;
+    }
+}
+
+static void check(int ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void test_start(void)
+{
+    // requested rate, then SMPLRT_DIV, DLPF_CFG and period expected for it
+    static const uint32_t rates[][4] = {
+        {2000, 0, 1, 1000},
+        {1000, 0, 1, 1000},
+        {500, 1, 1, 2000},
+        {300, 2, 2, 3000},
+        {200, 4, 2, 5000},
+        {100, 9, 3, 10000},
+        {4, 249, 6, 250000},
+        {1, 249, 6, 250000},
+    };
+    const struct i2c_dt_spec bus = {0x68};
+
+    for (int i = 0; i < ARRAY_SIZE(rates); i++) {
+        uint32_t period_us = 0;
+
+        memset(regs, 0, sizeof(regs));
+        fifo_push(1, 2, 3);
+        check(mpu6050_fifo_start(&bus, rates[i][0], &period_us) == 0, "start");
+        check(regs[MPU6050_SMPLRT_DIV] == rates[i][1], "sample rate divider");
+        check(regs[MPU6050_CONFIG] == rates[i][2], "low pass filter");
+        check(period_us == rates[i][3], "sample period");
+        check(regs[MPU6050_FIFO_EN] == MPU6050_FIFO_EN_ACCEL, "accelerometer alone in the FIFO");
+        check(regs[MPU6050_PWR_MGMT_2] == MPU6050_PWR_MGMT_2_STBY_GYRO, "gyros in standby");
+        check(regs[MPU6050_USER_CTRL] == MPU6050_USER_CTRL_FIFO_EN, "FIFO enabled");
+        check(fifo_bytes == 0, "FIFO emptied on start");
+    }
+}
+
+static void test_blocks(void)
+{
+    const struct i2c_dt_spec bus = {0x68};
+    int16_t xyz[BLOCK_SAMPLES][3];
+    int pending;
+    int ok = 1;
+
+    fifo_bytes = 0;
+    for (int i = 0; i < BLOCK_SAMPLES + 8; i++) {
+        fifo_push(i * 1000 - 20000, -i, MPU6050_COUNTS_PER_G);
+    }
+    check(mpu6050_fifo_read(&bus, xyz, BLOCK_SAMPLES, &pending) == BLOCK_SAMPLES, "full block read");
+    check(pending == 8, "rest of the FIFO pending");
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        ok &= xyz[i][0] == i * 1000 - 20000 && xyz[i][1] == -i && xyz[i][2] == MPU6050_COUNTS_PER_G;
+    }
+    check(ok, "samples byte-swapped in place");
+
+    // a partial block is read as far as it goes
+    check(mpu6050_fifo_read(&bus, xyz, BLOCK_SAMPLES, &pending) == 8, "partial block read");
+    check(pending == 0 && xyz[7][0] == (BLOCK_SAMPLES + 7) * 1000 - 20000, "partial block samples");
+    check(mpu6050_fifo_read(&bus, xyz, BLOCK_SAMPLES, &pending) == 0 && pending == 0, "empty FIFO");
+}
+
+static void test_resets(void)
+{
+    const struct i2c_dt_spec bus = {0x68};
+    int16_t xyz[BLOCK_SAMPLES][3];
+    int pending;
+
+    // a full FIFO has dropped samples
+    fifo_bytes = 0;
+    for (int i = 0; i < MPU6050_FIFO_SIZE / MPU6050_FIFO_SAMPLE_SIZE + 10; i++) {
+        fifo_push(1, 2, 3);
+    }
+    check(mpu6050_fifo_read(&bus, xyz, BLOCK_SAMPLES, &pending) == -EOVERFLOW, "overflow reported");
+    check(fifo_bytes == 0 && pending == 0, "overflowed FIFO reset");
+    check(regs[MPU6050_USER_CTRL] == MPU6050_USER_CTRL_FIFO_EN, "FIFO enabled after overflow");
+
+    // a partial sample means the FIFO is out of step with the samples
+    fifo_push(1, 2, 3);
+    fifo[fifo_bytes++] = 0;
+    check(mpu6050_fifo_read(&bus, xyz, BLOCK_SAMPLES, &pending) == -EOVERFLOW, "partial sample reported");
+    check(fifo_bytes == 0, "misaligned FIFO reset");
+
+    // and the next block is read normally
+    fifo_push(4, 5, 6);
+    check(mpu6050_fifo_read(&bus, xyz, BLOCK_SAMPLES, &pending) == 1 && xyz[0][2] == 6, "read after reset");
+}
+
+int main(void)
+{
+    test_start();
+    test_blocks();
+    test_resets();
+    fprintf(stderr, "%d failures\n", failures);
+    return failures ? 1 : 0;
+}
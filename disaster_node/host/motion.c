@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include "kalman_core.h"
+#include "kalman_port.h"
+
+/*
+* Motion check for the host build of the interacting multiple model filter.
+* Holds a target still for 10 s and then walks it across the grid, feeding
+* the ultrasonic and ranging fifos alternately every 50 ms, and checks the
+* model probabilities the node's motion alarm reads: once the still segment
+* has settled the stationary model must dominate, and after the walk starts
+* the moving model must rise above CONFIG_KALMAN_IMM_ALARM_PERMILLE.
+*
+* usage: kalman_motion
+*/
+// spacing of the simulated sensor messages (us)
+#define SAMPLE_PERIOD_US 50000
+#define STILL_US 10000000
+#define WALK_US 3000000
+// time the still segment gets to settle before it is checked
+#define SETTLE_US 5000000
+// walking speed along x and y (m/s)
+#define WALK_VX 0.7
+#define WALK_VY 0.35
+
+// fixed-seed uniform noise in [-amplitude, amplitude] so runs are comparable
+static double noise(uint32_t* seed, double amplitude)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return amplitude * ((double)(*seed >> 8) / (1 << 24) * 2 - 1);
+}
+
+// same model and noise as the node's filter thread
+static void motion_init(Kalman* filter)
+{
+    const int32_t x_init[4] = {KALMAN_MICRO, KALMAN_MICRO, 0, 0};
+
+    init_kalman(filter, 4, x_init, 10 * KALMAN_MICRO, 10000, 1000 * KALMAN_MICRO,
+        1000 * KALMAN_MICRO, 10000, 300000, KALMAN_TICKS_PER_SEC, 2, 4);
+}
+
+int main(void)
+{
+    static Kalman kalman;
+    kalman_obs obs;
+    uint32_t seed = 1;
+    int64_t last_ticks = 0;
+    int still_permille = 0;
+    int walk_permille = 0;
+
+    motion_init(&kalman);
+    kalman_observe_init(obs, KALMAN_MICRO, KALMAN_MICRO);
+    for (int64_t now = 0; now < STILL_US + WALK_US; now += SAMPLE_PERIOD_US) {
+        double walked = (now > STILL_US) ? (now - STILL_US) / 1e6 : 0;
+        bool from_us = (now / SAMPLE_PERIOD_US) % 2 == 0;
+        // ultrasonic readings carry about 3 cm of noise, ranging about 12 cm
+        double amplitude = from_us ? 0.03 : 0.12;
+        int32_t x = (int32_t)((1 + WALK_VX * walked + noise(&seed, amplitude)) * KALMAN_MICRO);
+        int32_t y = (int32_t)((1 + WALK_VY * walked + noise(&seed, amplitude)) * KALMAN_MICRO);
+
+        uint8_t rows = kalman_observe(x, y, from_us, obs);
+        kalman_set_dt_ticks(&kalman, kalman_elapsed_ticks(&last_ticks, now));
+        kalman_step(obs, rows, &kalman);
+
+        int permille = (int)(kalman.imm_prob[IMM_MOVING] * 1000);
+        if (now >= SETTLE_US && now < STILL_US) {
+            still_permille = (permille > still_permille) ? permille : still_permille;
+        } else if (now >= STILL_US) {
+            walk_permille = (permille > walk_permille) ? permille : walk_permille;
+        }
+    }
+
+    fprintf(stderr, "largest moving probability %d permille still, %d permille walking (alarm %d)\n",
+            still_permille, walk_permille, CONFIG_KALMAN_IMM_ALARM_PERMILLE);
+    return (still_permille < 500 && walk_permille > CONFIG_KALMAN_IMM_ALARM_PERMILLE) ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <time.h>
+#include "kalman_port.h"
+#include "port.h"
+
+// the host build links with --wrap so these replace the libc allocators
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static uint64_t allocations;
+
+void* __wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void* kalman_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void kalman_free(void* ptr)
+{
+    free(ptr);
+}
+
+uint64_t port_allocations(void)
+{
+    return allocations;
+}
+
+uint64_t port_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
@@ -0,0 +1,18 @@
+#ifndef KALMAN_HOST_PORT_H
+#define KALMAN_HOST_PORT_H
+
+#include <stdint.h>
+
+/*
+* Host side of the kalman platform shim (kalman_port.h) plus the counters the
+* benchmark and replay tools read. Every malloc/calloc/realloc in the process
+* is counted, not only kalman_malloc(), so an allocation slipping into the
+* core shows up without it having to use the shim.
+*/
+
+// heap allocations made since the process started
+uint64_t port_allocations(void);
+// monotonic clock in nanoseconds
+uint64_t port_now_ns(void);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "kalman_core.h"
+#include "kalman_port.h"
+
+/*
+* Replay recorded sensor messages through the kalman core on the host, the
+* way the node's filter thread fuses them.
+*
+* usage: kalman_replay <observations.csv> [expected.csv [tolerance]]
+*
+* Each observation line is "timestamp_us,fifo,x,y" where fifo is "us" for the
+* ultrasonic fifo or "rs" for the ranging fifo, in timestamp order. A "pr"
+* line (x and y ignored) is a prediction period that passed without data, so
+* the filter only predicts, as the node's filter thread does on a timeout.
+* Lines starting with '#' are skipped. One estimate line
+* "timestamp_us,x,y,vx,vy,gated" is written to stdout per observation.
+*
+* With an expected file (a previous run's output) every estimate is compared
+* against it, and the exit status is 1 if any state differs by more than
+* tolerance (default 1e-6) or the gate rejected other rows than expected, so
+* a change to the core that moves the estimate is caught before it reaches
+* hardware.
+*/
+#define LINE_MAX_LEN 128
+#define DEFAULT_TOLERANCE 1e-6
+
+// next non-comment line of f, or NULL at the end
+static char* next_line(FILE* f, char* line)
+{
+    while (fgets(line, LINE_MAX_LEN, f) != NULL) {
+        if (line[0] != '#' && line[0] != '\n') {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+static void replay_init(Kalman* filter)
+{
+    const int32_t x_init[4] = {KALMAN_MICRO, KALMAN_MICRO, KALMAN_MICRO, KALMAN_MICRO};
+
+    init_kalman(filter, 4, x_init, 10 * KALMAN_MICRO, 10000, 1000 * KALMAN_MICRO,
+        1000 * KALMAN_MICRO, 10000, 300000, KALMAN_TICKS_PER_SEC, 2, 4);
+}
+
+// current estimate in m and m/s; the fixed-point core only hands out
+// integers, so the host reads its Q16.16 state directly
+static void read_estimate(const Kalman* filter, vec4 x)
+{
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    for (int i = 0; i < 4; i++) {
+        x[i] = fix16_to(filter->fx_x[i]);
+    }
+#else
+    kalman_estimate(filter, x);
+#endif
+}
+
+// a reading in m as the integer um the sensor thread sends
+static int32_t reading_um(double value)
+{
+    return (int32_t)lround(value * KALMAN_MICRO);
+}
+
+int main(int argc, char** argv)
+{
+    static Kalman kalman;
+    char line[LINE_MAX_LEN];
+    char expected_line[LINE_MAX_LEN];
+    kalman_obs obs;
+    vec4 estimate;
+    int64_t last_ticks = 0;
+    double tolerance = (argc > 3) ? atof(argv[3]) : DEFAULT_TOLERANCE;
+    double worst = 0;
+    long count = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <observations.csv> [expected.csv [tolerance]]\n", argv[0]);
+        return 2;
+    }
+    FILE* in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    FILE* expected = NULL;
+    if (argc > 2 && (expected = fopen(argv[2], "r")) == NULL) {
+        perror(argv[2]);
+        return 2;
+    }
+    replay_init(&kalman);
+    kalman_observe_init(obs, KALMAN_MICRO, KALMAN_MICRO);
+
+    while (next_line(in, line) != NULL) {
+        long long timestamp;
+        char fifo[3];
+        double x, y;
+
+        if (sscanf(line, "%lld,%2[a-z],%lf,%lf", &timestamp, fifo, &x, &y) != 4
+                || (strcmp(fifo, "us") && strcmp(fifo, "rs") && strcmp(fifo, "pr"))) {
+            fprintf(stderr, "%s: bad observation: %s", argv[1], line);
+            return 2;
+        }
+        if (count == 0) {
+            last_ticks = timestamp;
+        }
+        uint8_t gated = 0;
+        if (fifo[0] == 'p') {
+            kalman_set_dt_ticks(&kalman, kalman_elapsed_ticks(&last_ticks, timestamp));
+            kalman_predict(&kalman);
+        } else {
+            uint8_t rows = kalman_observe(reading_um(x), reading_um(y), fifo[0] == 'u', obs);
+            if (rows) {
+                kalman_set_dt_ticks(&kalman, kalman_elapsed_ticks(&last_ticks, timestamp));
+                gated = kalman_step(obs, rows, &kalman) & rows;
+            }
+        }
+        read_estimate(&kalman, estimate);
+        printf("%lld,%.9f,%.9f,%.9f,%.9f,%u\n", timestamp, estimate[0], estimate[1],
+                estimate[2], estimate[3], gated);
+        count++;
+
+        if (expected != NULL) {
+            long long expected_timestamp;
+            double state[4];
+            unsigned expected_gated;
+
+            if (next_line(expected, expected_line) == NULL
+                    || sscanf(expected_line, "%lld,%lf,%lf,%lf,%lf,%u", &expected_timestamp,
+                        &state[0], &state[1], &state[2], &state[3], &expected_gated) != 6
+                    || expected_timestamp != timestamp) {
+                fprintf(stderr, "%s: no estimate for observation %ld\n", argv[2], count);
+                return 1;
+            }
+            if (expected_gated != gated) {
+                fprintf(stderr, "%s: observation %ld gated rows %u, expected %u\n", argv[1],
+                        count, gated, expected_gated);
+                return 1;
+            }
+            for (int i = 0; i < 4; i++) {
+                double error = state[i] - estimate[i];
+                error = (error < 0) ? -error : error;
+                worst = (error > worst) ? error : worst;
+            }
+        }
+    }
+    fclose(in);
+    if (expected != NULL) {
+        fclose(expected);
+        fprintf(stderr, "%ld observations, largest state error %g (tolerance %g)\n", count, worst, tolerance);
+        return (worst > tolerance) ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef HOST_STUB_ZEPHYR_DRIVERS_I2C_H
+#define HOST_STUB_ZEPHYR_DRIVERS_I2C_H
+
+#include <stdint.h>
+
+/*
+* I2C calls of the register-level drivers. The host test linking a driver
+* implements them on top of its simulated part.
+*/
+struct i2c_dt_spec {
+        uint16_t addr;                // 7-bit address of the part
+};
+
+int i2c_reg_write_byte_dt(const struct i2c_dt_spec* spec, uint8_t reg, uint8_t value);
+int i2c_reg_read_byte_dt(const struct i2c_dt_spec* spec, uint8_t reg, uint8_t* value);
+int i2c_burst_read_dt(const struct i2c_dt_spec* spec, uint8_t reg, uint8_t* buf, uint32_t len);
+
+#endif
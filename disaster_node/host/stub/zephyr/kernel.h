@@ -0,0 +1,19 @@
+#ifndef HOST_STUB_ZEPHYR_KERNEL_H
+#define HOST_STUB_ZEPHYR_KERNEL_H
+
+#include <zephyr/sys/util.h>
+
+/*
+* The few kernel calls the register-level drivers make, for host tests that
+* build them outside Zephyr. Sleeps return at once: the simulated parts
+* settle instantly.
+*/
+#define USEC_PER_SEC 1000000
+
+static inline int32_t k_msleep(int32_t ms)
+{
+    (void)ms;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HOST_STUB_ZEPHYR_SYS_BYTEORDER_H
+#define HOST_STUB_ZEPHYR_SYS_BYTEORDER_H
+
+#include <stdint.h>
+
+static inline uint16_t sys_get_be16(const uint8_t src[2])
+{
+    return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+static inline uint16_t sys_be16_to_cpu(uint16_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return value;
+#else
+    return (uint16_t)((value >> 8) | (value << 8));
+#endif
+}
+
+#endif
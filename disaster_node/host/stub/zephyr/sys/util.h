@@ -0,0 +1,12 @@
+#ifndef HOST_STUB_ZEPHYR_SYS_UTIL_H
+#define HOST_STUB_ZEPHYR_SYS_UTIL_H
+
+#include <stdint.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define BIT(n) (1UL << (n))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define CLAMP(val, low, high) (((val) <= (low)) ? (low) : MIN(val, high))
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// accelerometer samples the kalman filter can hold in its queue
+#define ACCEL_QUEUE_DEPTH 16
+
+// one MPU6050 reading, handed to the kalman filter as its control input.
+// The sensor is mounted with its x and y axes along the filter's.
+struct accel_sample {
+        int64_t timestamp; // k_uptime_ticks() when the sample was taken
+        int32_t ax;        // micro m/s^2 along x, rest bias removed
+        int32_t ay;        // micro m/s^2 along y, rest bias removed
+};
+
+extern struct k_msgq kalman_accel_msgq;
+
+#ifdef CONFIG_ACCEL_FIFO
+// samples read from the MPU6050 FIFO in one burst
+#define ACCEL_BLOCK_SAMPLES CONFIG_ACCEL_FIFO_BLOCK
+// consumers of the sample blocks, see accel_add_block_handler()
+#define ACCEL_BLOCK_HANDLERS 4
+
+// a burst of consecutive accelerometer samples from the FIFO
+struct accel_block {
+        int64_t timestamp;  // k_uptime_ticks() of the first sample
+        uint32_t period_us; // time between samples
+        uint16_t count;     // samples in xyz
+        bool gap;           // samples were lost just before this block
+        // raw x, y, z counts (MPU6050_COUNTS_PER_G), rest bias not removed
+        int16_t xyz[ACCEL_BLOCK_SAMPLES][3];
+};
+
+typedef void (*accel_block_handler)(const struct accel_block* block);
+
+// call handler with every block, from the accelerometer thread
+int accel_add_block_handler(accel_block_handler handler);
+#endif
+
+void accelerometer();
+
+#endif
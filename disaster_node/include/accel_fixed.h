@@ -0,0 +1,60 @@
+#ifndef ACCEL_FIXED_H
+#define ACCEL_FIXED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/util.h>
+
+/*
+* Integer detection pipeline shared by the polled and FIFO accelerometer
+* paths, so the accelerometer thread needs no floating point unless the
+* band energy classifier (CONFIG_ACCEL_BANDS), whose FFT is float, runs in it.
+* Readings are carried as micro m/s^2 in int32_t, the unit of struct
+* sensor_value's val2, and raw MPU6050 counts are converted with one integer
+* multiply. Every sample is checked against the fall thresholds, has gravity
+* (its slowly varying part) removed by a one-pole integer high pass filter,
+* and the peak of the squared magnitude of what is left is compared with
+* the shaking threshold, so no square root is taken either.
+*/
+// micro m/s^2 per m/s^2
+#define ACCEL_MICRO 1000000
+
+// events reported by accel_fixed_update()
+#define ACCEL_FELL        BIT(0) // beyond the fall thresholds
+#define ACCEL_SHAKE_START BIT(1) // dynamic acceleration rose above threshold
+#define ACCEL_SHAKE_STOP  BIT(2) // and fell back below half of it
+
+struct accel_fixed {
+        int32_t gravity[3]; // low pass estimate of each axis, micro m/s^2
+        int64_t envelope;   // decaying peak of the squared dynamic magnitude
+        bool primed;        // gravity holds at least one reading
+        bool shaking;
+};
+
+/*
+* accel_fixed_from_sensor()
+* micro m/s^2 from a sensor driver reading.
+*/
+static inline int32_t accel_fixed_from_sensor(const struct sensor_value* value)
+{
+    return value->val1 * ACCEL_MICRO + value->val2;
+}
+
+/*
+* accel_fixed_from_counts()
+* micro m/s^2 from raw MPU6050 counts at +-2 g (16384 per g).
+* 9.80665e6 / 16384 = 598.55 is taken as 19154 / 32, within 0.003%,
+* which keeps the product of a full scale reading inside int32_t.
+*/
+static inline int32_t accel_fixed_from_counts(int16_t counts)
+{
+    return counts * 19154 / 32;
+}
+
+void accel_fixed_init(struct accel_fixed* state);
+// run one x, y, z reading (micro m/s^2) through the detectors, returning
+// the ACCEL_* events it raised
+int accel_fixed_update(struct accel_fixed* state, const int32_t xyz[3]);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef BAND_ENERGY_H
+#define BAND_ENERGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "accel.h"
+
+/*
+* Band energy analysis of the accelerometer FIFO blocks. Samples are
+* averaged down by CONFIG_ACCEL_BANDS_DECIMATION, cut into frames of
+* CONFIG_ACCEL_BANDS_FFT_SIZE overlapping by half, and each frame has its
+* mean (gravity and tilt) removed, a Hann window applied and a real FFT
+* taken per axis. The power of the bins is summed into the bands between the
+* edges in CONFIG_ACCEL_BANDS_EDGES, as mean square acceleration.
+*
+* A frame is seismic when its energy is above CONFIG_ACCEL_BANDS_MIN_RMS and
+* mostly below CONFIG_ACCEL_BANDS_SEISMIC_MAX_HZ: earthquakes shake at a few
+* Hz, while door slams and footsteps are short and broadband.
+*/
+#define BAND_ENERGY_FFT_SIZE CONFIG_ACCEL_BANDS_FFT_SIZE
+// most bands CONFIG_ACCEL_BANDS_EDGES may describe
+#define BAND_ENERGY_MAX_BANDS 8
+
+#if (BAND_ENERGY_FFT_SIZE & (BAND_ENERGY_FFT_SIZE - 1)) != 0
+#error "CONFIG_ACCEL_BANDS_FFT_SIZE must be a power of two"
+#endif
+
+// energy of one analysed frame
+struct band_energy_frame {
+        int64_t timestamp;                   // k_uptime_ticks() of its first sample
+        int bands;                           // bands in energy
+        float energy[BAND_ENERGY_MAX_BANDS]; // (m/s^2)^2 in each band
+        float total;                         // (m/s^2)^2 over all bins
+        bool seismic;
+};
+
+// parse the band edges and build the tables for samples period_us apart,
+// -EINVAL if the edges are bad
+int band_energy_init(uint32_t period_us);
+// accelerometer block handler, see accel_add_block_handler()
+void band_energy_block(const struct accel_block* block);
+// whether the latest frame was seismic
+bool band_energy_seismic(void);
+
+#endif
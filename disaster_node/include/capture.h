@@ -0,0 +1,69 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+* Pre-trigger event capture. Raw ultrasonic ranges, accelerometer samples
+* and kalman filter estimates are written as they are taken into one
+* statically allocated ring of CONFIG_CAPTURE_RECORDS timestamped records,
+* overwriting the oldest. capture_trigger(), called wherever the earthquake
+* alarm is raised, keeps recording for CONFIG_CAPTURE_POST_MS (or until
+* half the ring is post-trigger, so at least half is onset) and then
+* freezes the ring, which capture_export() streams out as a blob:
+*
+*   struct capture_header, then header.count struct capture_record,
+*   oldest first, all in the node's byte order (little-endian on the ESP32).
+*
+* capture_rearm() starts recording the next event; with CONFIG_CAPTURE_DUMP
+* a thread of its own prints each event to the console and re-arms. Records
+* may come from any thread; each write is a few stores under a spinlock.
+*/
+#define CAPTURE_RECORDS CONFIG_CAPTURE_RECORDS
+// "EQCP" read as a little-endian uint32_t
+#define CAPTURE_MAGIC 0x50435145
+#define CAPTURE_VERSION 1
+
+enum capture_kind {
+        CAPTURE_RANGE,    // ultrasonic range, value[0] in mm
+        CAPTURE_ACCEL,    // x, y, z in mm/s^2, gravity included
+        CAPTURE_POSITION, // filter x, y in mm
+        CAPTURE_VELOCITY, // filter vx, vy in mm/s
+};
+
+struct capture_record {
+        uint32_t ticks;   // low 32 bits of k_uptime_ticks() when taken
+        uint8_t kind;     // enum capture_kind
+        uint8_t source;   // ultrasonic sensor number, else 0
+        int16_t value[3]; // saturated at the int16_t range
+};
+
+struct capture_header {
+        int64_t trigger_ticks;     // k_uptime_ticks() of the trigger
+        uint32_t magic;            // CAPTURE_MAGIC
+        uint16_t version;          // CAPTURE_VERSION
+        uint16_t record_size;      // sizeof(struct capture_record)
+        uint32_t ticks_per_sec;
+        uint32_t count;            // records following the header
+        uint32_t trigger;          // index of the first record after the trigger
+        uint32_t accel_decimation; // accelerometer samples per record
+};
+
+// sink for capture_export(), returns 0 or a negative error to stop
+typedef int (*capture_write_fn)(const void* data, size_t len, void* ctx);
+
+void capture_add(int64_t ticks, enum capture_kind kind, uint8_t source, int32_t v0, int32_t v1, int32_t v2);
+// an accelerometer sample in micro m/s^2, kept one in CONFIG_CAPTURE_ACCEL_DECIMATION
+void capture_accel(int64_t ticks, const int32_t xyz[3]);
+// mark the trigger, ignored unless armed
+void capture_trigger(void);
+// whether the post-trigger window is over and the ring frozen
+bool capture_frozen(void);
+// stream the frozen event to write, -EBUSY if it is not frozen yet
+int capture_export(capture_write_fn write, void* ctx);
+// discard the frozen event and record the next
+void capture_rearm(void);
+
+#endif
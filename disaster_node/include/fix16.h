@@ -0,0 +1,130 @@
+#ifndef FIX16_H
+#define FIX16_H
+
+#include <stdint.h>
+#include "mat4.h"
+
+/*
+* Q16.16 signed fixed-point arithmetic used by the fixed-point kalman kernel
+* (CONFIG_KALMAN_UPDATE_FIXED). Values cover +-32768 with a resolution of
+* 1/65536. Every operation rounds to nearest and saturates at the ends of the
+* range instead of wrapping, so an overflow degrades the estimate rather than
+* flipping its sign. Products and quotients go through 64-bit intermediates.
+*/
+typedef int32_t fix16;
+
+#define FIX16_ONE ((fix16)1 << 16)
+#define FIX16_MAX INT32_MAX
+#define FIX16_MIN INT32_MIN
+
+/*
+* fix16_sat()
+* clamp a 64-bit intermediate into the Q16.16 range.
+*/
+static inline fix16 fix16_sat(int64_t v)
+{
+    if (v > FIX16_MAX) {
+        return FIX16_MAX;
+    }
+    if (v < FIX16_MIN) {
+        return FIX16_MIN;
+    }
+    return (fix16)v;
+}
+
+/*
+* fix16_from()
+* convert a filter scalar to Q16.16. Only used where values cross between
+* the filter and its callers, not in the kernel itself.
+*/
+static inline fix16 fix16_from(kf_scalar v)
+{
+    v *= FIX16_ONE;
+    if (v >= (kf_scalar)FIX16_MAX) {
+        return FIX16_MAX;
+    }
+    if (v <= (kf_scalar)FIX16_MIN) {
+        return FIX16_MIN;
+    }
+    return (fix16)(v < 0 ? v - (kf_scalar)0.5 : v + (kf_scalar)0.5);
+}
+
+/*
+* fix16_to()
+* convert Q16.16 back to a filter scalar.
+*/
+static inline kf_scalar fix16_to(fix16 v)
+{
+    return (kf_scalar)v / FIX16_ONE;
+}
+
+// a + b, saturating
+static inline fix16 fix16_add(fix16 a, fix16 b)
+{
+    return fix16_sat((int64_t)a + b);
+}
+
+// a - b, saturating
+static inline fix16 fix16_sub(fix16 a, fix16 b)
+{
+    return fix16_sat((int64_t)a - b);
+}
+
+/*
+* fix16_div64()
+* round-to-nearest quotient of a 64-bit numerator by a positive or negative
+* divisor, saturated into Q16.16. Division by zero saturates by sign.
+*/
+static inline fix16 fix16_div64(int64_t num, int64_t den)
+{
+    if (den == 0) {
+        return (num < 0) ? FIX16_MIN : FIX16_MAX;
+    }
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    // a 64-bit numerator this large already saturates the result
+    if (num > INT64_MAX / 2 || num < -(INT64_MAX / 2)) {
+        return (num < 0) ? FIX16_MIN : FIX16_MAX;
+    }
+    int64_t half = den / 2;
+    return fix16_sat((num < 0 ? num - half : num + half) / den);
+}
+
+/*
+* fix16_from_ratio()
+* num / den in Q16.16 from integers, such as a tick count over the tick rate
+* or a reading in micro units over a million, without going through a float.
+*/
+static inline fix16 fix16_from_ratio(int64_t num, int64_t den)
+{
+    // num * FIX16_ONE would overflow; the quotient saturates for any
+    // divisor used here
+    if (num > INT64_MAX / 2 / FIX16_ONE || num < -(INT64_MAX / 2 / FIX16_ONE)) {
+        return ((num < 0) != (den < 0)) ? FIX16_MIN : FIX16_MAX;
+    }
+    return fix16_div64(num * FIX16_ONE, den);
+}
+
+// a * b, rounded and saturating
+static inline fix16 fix16_mul(fix16 a, fix16 b)
+{
+    int64_t p = (int64_t)a * b;
+
+    return fix16_sat((p + (p < 0 ? -(FIX16_ONE / 2) : FIX16_ONE / 2)) / FIX16_ONE);
+}
+
+// a / b, rounded and saturating
+static inline fix16 fix16_div(fix16 a, fix16 b)
+{
+    return fix16_div64((int64_t)a * FIX16_ONE, b);
+}
+
+// a * b / c with a single rounding, saturating
+static inline fix16 fix16_mul_div(fix16 a, fix16 b, fix16 c)
+{
+    return fix16_div64((int64_t)a * b, c);
+}
+
+#endif
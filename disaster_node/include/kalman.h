@@ -8,14 +8,33 @@ extern struct k_fifo signal_fifo;
 
 extern struct k_sem signal;
 
+// readings are in integer um so the filter thread takes them straight into
+// its own arithmetic, see kalman_observe()
 struct kalman_values {
-        double x;
-        double y;
-        double vx;
-        double vy;
+        void *fifo_reserved;
+        int32_t x;
+        int32_t y;
+        int32_t vx;
+        int32_t vy;
         int sensor;
+        int64_t timestamp; // k_uptime_ticks() when the sample was taken
 };
 
+// backlog counters for one sensor fifo
+struct kalman_queue_stats {
+        uint32_t depth;      // messages waiting for the filter
+        uint32_t high_water; // deepest the queue has been
+        uint32_t dropped;    // oldest messages discarded because it was full
+        uint32_t gated;      // samples rejected or down-weighted by the
+                             // innovation gate
+};
+
+void kalman_put(struct k_fifo* fifo, struct kalman_values* data);
+void kalman_queue_stats_get(struct k_fifo* fifo, struct kalman_queue_stats* stats);
+#ifdef CONFIG_KALMAN_IMM
+// probability (per mille) that the node is moving
+uint32_t kalman_motion_permille(void);
+#endif
 void create_filter();
 
 #endif
\ No newline at end of file
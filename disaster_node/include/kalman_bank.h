@@ -0,0 +1,73 @@
+#ifndef KALMAN_BANK_H
+#define KALMAN_BANK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mat4.h"
+
+/*
+* Bank of constant-velocity kalman filters tracking many targets (e.g. other
+* disaster nodes heard by an aggregator) in structure-of-arrays form: every
+* field of every target is stored contiguously, indexed by slot, so predict
+* and update run as straight loops over the slots that the compiler can
+* vectorize.
+*
+* As in the decoupled single filter, the model never couples x and y, so
+* each target is two independent (position, velocity) axes with a 2x2
+* covariance stored as its three distinct entries. Slots 0..count-1 are
+* always in use; removing a target moves the last target into its slot.
+* Targets are found by id through an open-addressed hash index, so lookups
+* stay O(1) however many are tracked. Storage is owned by the caller and the
+* bank never allocates.
+*
+* The node firmware tracks only itself, so the bank is built for the host
+* (see host/CMakeLists.txt) and not into the Zephyr app.
+*/
+#ifndef KALMAN_BANK_SIZE
+#define KALMAN_BANK_SIZE 128
+#endif
+// index entries, at most half of them used so probe runs stay short
+#define KALMAN_BANK_INDEX_SIZE (2 * KALMAN_BANK_SIZE)
+
+#if KALMAN_BANK_SIZE >= UINT16_MAX
+#error "KALMAN_BANK_SIZE must fit the uint16_t index entries"
+#endif
+
+enum { KALMAN_BANK_X, KALMAN_BANK_Y };
+
+struct kalman_bank {
+        int count;                             // slots in use
+        kf_scalar proc_err;                    // process noise per second
+        kf_scalar meas_err;                    // position measurement error
+        uint32_t id[KALMAN_BANK_SIZE];         // target in each slot
+        // slot + 1 of each target by hash of its id, linear probing, 0 = empty
+        uint16_t index[KALMAN_BANK_INDEX_SIZE];
+        // state, per axis
+        kf_scalar pos[2][KALMAN_BANK_SIZE];
+        kf_scalar vel[2][KALMAN_BANK_SIZE];
+        // covariance, per axis
+        kf_scalar cov_pp[2][KALMAN_BANK_SIZE];
+        kf_scalar cov_pv[2][KALMAN_BANK_SIZE];
+        kf_scalar cov_vv[2][KALMAN_BANK_SIZE];
+        // observations staged by kalman_bank_observe() for the next update,
+        // fresh is 1 for slots with a staged observation, else 0
+        kf_scalar obs[2][KALMAN_BANK_SIZE];
+        kf_scalar fresh[KALMAN_BANK_SIZE];
+};
+
+void kalman_bank_init(struct kalman_bank* bank, kf_scalar proc_err, kf_scalar meas_err);
+// slot of target id, or -1 if it is not tracked
+int kalman_bank_find(const struct kalman_bank* bank, uint32_t id);
+// start tracking id at (x, y), returns its slot or -1 if the bank is full
+// or id is already tracked
+int kalman_bank_add(struct kalman_bank* bank, uint32_t id, kf_scalar x, kf_scalar y, kf_scalar init_err);
+// stop tracking id, returns -1 if it was not tracked
+int kalman_bank_remove(struct kalman_bank* bank, uint32_t id);
+// stage a position observation of id for the next kalman_bank_update()
+int kalman_bank_observe(struct kalman_bank* bank, uint32_t id, kf_scalar x, kf_scalar y);
+// advance every target dt seconds
+void kalman_bank_predict(struct kalman_bank* bank, kf_scalar dt);
+// fuse every staged observation and clear them
+void kalman_bank_update(struct kalman_bank* bank);
+
+#endif
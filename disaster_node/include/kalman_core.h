@@ -0,0 +1,182 @@
+#ifndef KALMAN_CORE_H
+#define KALMAN_CORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mat4.h"
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+#include "fix16.h"
+#endif
+
+/*
+* Numerical core of the kalman filter: the filter state and its predict and
+* update steps. Nothing here depends on the kernel, so the same source builds
+* into the Zephyr app (threaded by kalman.c) and for the host (see host/).
+*/
+// observation rows fed by each fifo
+#define OBS_RS_X (1 << 0)
+#define OBS_RS_Y (1 << 1)
+#define OBS_US_X (1 << 2)
+#define OBS_US_Y (1 << 3)
+#define OBS_ALL (OBS_RS_X | OBS_RS_Y | OBS_US_X | OBS_US_Y)
+
+// readings and control inputs reach the filter as integers in micro units
+// (um, um/s^2), converted in here only into whatever the update mode runs in
+#define KALMAN_MICRO 1000000
+
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+// observation of each row, Q16.16 end to end in the fixed-point mode
+typedef fix16 kalman_obs[4];
+#else
+typedef kf_scalar kalman_obs[4];
+#endif
+
+// the UD and decoupled modes keep the covariance factored instead of in a
+// full matrix and the fixed-point mode keeps it in Q16.16, see kalman_state()
+#if !defined(CONFIG_KALMAN_UPDATE_UD) && !defined(CONFIG_KALMAN_UPDATE_DECOUPLED) \
+        && !defined(CONFIG_KALMAN_UPDATE_FIXED)
+#define KALMAN_FULL_COV
+#endif
+
+#ifdef CONFIG_KALMAN_IMM
+// models of the interacting multiple model filter, which differ only in
+// their process noise
+enum { IMM_STATIONARY, IMM_MOVING, IMM_MODELS };
+#endif
+
+#ifdef CONFIG_KALMAN_STEADY_STATE
+// number of distinct sets of fused observation rows with a cached gain
+#define STEADY_GAIN_SLOTS 4
+
+// converged gain for one set of fused observation rows. The sensors
+// alternate, so the covariance settles into a cycle rather than a single
+// fixed point; keying the gain on the rows fused gives each phase its own.
+struct steady_gain {
+        uint8_t rows;   // observation rows fused (bit i = obs[i]), 0 = unused
+        uint8_t stable; // consecutive updates with a converged covariance
+        bool locked;    // K is valid and used in place of the full update
+        mat4 K;
+        mat4 cov;       // covariance after the last update with these rows
+        vec4 innov_var; // innovation variance of each fused row, for gating
+#ifdef CONFIG_KALMAN_STATE_LOG
+        mat4 prior_cov; // predicted covariance before that update, for the log
+#endif
+};
+#endif
+
+// struct to define the paramters of the kalman filter and store matrices.
+// All matrices are fixed size and stored inline so the filter never touches
+// the heap once created.
+typedef struct {
+        int ndim;
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+        // Q16.16 state, covariance and model, replace x_hat, cov, A, Q and
+        // R so no step touches a float. Read the estimate with
+        // kalman_estimate_milli().
+        fix16 fx_x[4];
+        fix16 fx_cov[4][4];
+        fix16 fx_dt;
+        fix16 fx_proc_err; // process noise per second
+        fix16 fx_q;        // diagonal of Q, fx_proc_err * fx_dt
+        fix16 fx_r[4];     // diagonal of R
+#else
+        mat4 A;
+        mat4 H;
+        kf_scalar dt;    // time step (s) A and Q are set for
+        vec4 x_hat;
+#ifdef KALMAN_FULL_COV
+        mat4 cov;
+#endif
+        mat4 Q;
+        mat4 R;
+        double proc_err; // process noise per second, Q = proc_err * dt * I
+        vec4 innov_var;  // innovation variance of each row at its last update
+        vec4 innov;      // innovation of each row at its last update
+#endif
+#ifdef CONFIG_KALMAN_UPDATE_UD
+        // packed UD factor of the covariance, cov = U * D * U^T, with the unit
+        // upper triangular U above the diagonal and D on it. Replaces cov.
+        kf_scalar ud[10];
+#endif
+#ifdef CONFIG_KALMAN_UPDATE_DECOUPLED
+        // per-axis 2x2 (position, velocity) covariance, replaces cov
+        kf_scalar axis_cov[2][3];
+#endif
+#ifdef CONFIG_KALMAN_IMM
+        // per-model state and covariance, and the probability of each model.
+        // x_hat and cov hold the blended estimate.
+        vec4 imm_x[IMM_MODELS];
+        mat4 imm_cov[IMM_MODELS];
+        kf_scalar imm_prob[IMM_MODELS];
+#endif
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+        // x and y acceleration (control input), held from one accelerometer
+        // sample to the next
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+        fix16 fx_accel[2];
+#else
+        kf_scalar accel[2];
+#endif
+#endif
+        int m;
+        int n;
+#ifdef CONFIG_KALMAN_STEADY_STATE
+        struct steady_gain gains[STEADY_GAIN_SLOTS];
+#endif
+#ifdef CONFIG_KALMAN_STATE_LOG
+        // estimate after the last prediction and the time predicted over
+        // since the last record, see kalman_log_get()
+        vec4 prior_x;
+        mat4 prior_cov;
+        double prior_dt;
+#endif
+} Kalman;
+
+#ifdef CONFIG_KALMAN_STATE_LOG
+// one step of the forward pass, as needed by a Rauch-Tung-Striebel smoother
+struct kalman_log_record {
+        double dt;       // time from the previous record's update to this one
+        vec4 prior_x;    // predicted state and covariance before the update
+        mat4 prior_cov;
+        vec4 x;          // state and covariance after the update
+        mat4 cov;
+};
+#endif
+
+// state (um, um/s), its variance and the noise in micro units, dt in ticks
+void init_kalman(Kalman* filter, int ndim, const int32_t x_init[4], int32_t init_err, int32_t meas_err_rssi_x, int32_t meas_err_rssi_y, int32_t meas_err_us_x, int32_t meas_err_us_y, int32_t proc_err, int64_t dt, int m, int n);
+#ifndef CONFIG_KALMAN_UPDATE_FIXED
+void kalman_set_dt(Kalman* filter, double dt);
+#endif
+// kalman_set_dt() for a time step in kernel ticks
+void kalman_set_dt_ticks(Kalman* filter, int64_t ticks);
+void kalman_set_noise(Kalman* filter, int32_t meas_err_rssi_x, int32_t meas_err_rssi_y, int32_t meas_err_us_x, int32_t meas_err_us_y, int32_t proc_err);
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+// hold (ax, ay), in micro m/s^2, as the control input of the following
+// predictions
+void kalman_set_control(Kalman* filter, int32_t ax, int32_t ay);
+#endif
+// propagate the filter forward one step without a measurement
+void kalman_predict(Kalman* filter);
+// predict and fuse the observation rows set in rows, returns the rows gated
+uint8_t kalman_step(const kalman_obs obs, uint8_t rows, Kalman* filter);
+#ifndef CONFIG_KALMAN_UPDATE_FIXED
+// current estimate and its covariance, whatever form the update mode keeps
+void kalman_state(const Kalman* filter, vec4 x, mat4 cov);
+// current estimate (x, y, vx, vy) alone
+void kalman_estimate(const Kalman* filter, vec4 x);
+#endif
+// current estimate in milli units (mm, mm/s), for integer-only consumers
+void kalman_estimate_milli(const Kalman* filter, int32_t x[4]);
+#ifdef CONFIG_KALMAN_STATE_LOG
+// forward pass record of the last step, starts the next record
+void kalman_log_get(Kalman* filter, struct kalman_log_record* record);
+#endif
+// ticks since *last_ticks, advancing it to now
+int64_t kalman_elapsed_ticks(int64_t* last_ticks, int64_t now);
+// seed every observation row with a starting position (um)
+void kalman_observe_init(kalman_obs obs, int32_t x, int32_t y);
+// copy a sensor reading (um) into obs, returns the observation rows refreshed
+uint8_t kalman_observe(int32_t x, int32_t y, bool from_us, kalman_obs obs);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef KALMAN_GEN_H
+#define KALMAN_GEN_H
+
+#include "mat4.h"
+
+/*
+* Generated at build time by scripts/gen_kalman.py from
+* model/kalman_model.json. The model setup is used by every update mode; the
+* kernel (CONFIG_KALMAN_UPDATE_GENERATED) unrolls the products with the
+* model's A and H with structural zeros and unit multiplies removed. P is
+* symmetric and kept symmetric.
+*/
+
+// A for the time step dt
+void kalman_gen_transition(kf_scalar A[4][4], kf_scalar dt);
+
+// H, the state each observation row measures
+void kalman_gen_observation(kf_scalar H[4][4]);
+
+// x = A * x, P = A * P * A^T + Q
+void kalman_gen_predict(kf_scalar x[4], kf_scalar P[4][4], const kf_scalar Q[4][4], kf_scalar dt);
+
+// for observation row: PHT = P * h^T, *hPhT = h * P * h^T, returns h * x
+kf_scalar kalman_gen_innovation(int row, const kf_scalar x[4], const kf_scalar P[4][4],
+        kf_scalar PHT[4], kf_scalar* hPhT);
+
+// scalar update with gain PHT / s: x += K * error, P -= K * PHT^T
+void kalman_gen_correct(kf_scalar x[4], kf_scalar P[4][4], const kf_scalar PHT[4],
+        kf_scalar error, kf_scalar s);
+
+#endif
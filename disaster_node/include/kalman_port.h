@@ -0,0 +1,37 @@
+#ifndef KALMAN_PORT_H
+#define KALMAN_PORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* Platform shim for the kalman core. The core takes its tick rate and any
+* memory it needs from here instead of the kernel, so it also builds for the
+* host. The filter itself never allocates; anything added to the core that
+* must, goes through kalman_malloc() so the host benchmark counts it.
+*/
+#ifdef __ZEPHYR__
+#include <zephyr/kernel.h>
+
+// sample timestamps are k_uptime_ticks()
+#define KALMAN_TICKS_PER_SEC CONFIG_SYS_CLOCK_TICKS_PER_SEC
+
+static inline void* kalman_malloc(size_t size)
+{
+    return k_malloc(size);
+}
+
+static inline void kalman_free(void* ptr)
+{
+    k_free(ptr);
+}
+#else
+// host timestamps are microseconds
+#define KALMAN_TICKS_PER_SEC 1000000
+
+// provided by the host build, see host/port.c
+void* kalman_malloc(size_t size);
+void kalman_free(void* ptr);
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef MAT4_H
+#define MAT4_H
+
+/*
+* Fixed-size 4x4 matrix and 4x1 vector types used by the kalman filter.
+* Storage is contiguous and owned by the caller (stack or static), so none of
+* these operations allocate. Unless noted otherwise, the output of a product
+* must not alias either of its inputs.
+*
+* The scalar type is float when CONFIG_KALMAN_SINGLE_PRECISION is set so the
+* filter runs on the single-precision FPU instead of emulated doubles.
+*/
+#ifdef CONFIG_KALMAN_SINGLE_PRECISION
+typedef float kf_scalar;
+// <math.h> functions of a kf_scalar
+#define kf_log logf
+#define kf_exp expf
+#else
+typedef double kf_scalar;
+#define kf_log log
+#define kf_exp exp
+#endif
+
+typedef kf_scalar mat4[4][4];
+typedef kf_scalar vec4[4];
+
+void mat4_print(const mat4 a);
+void mat4_identity(mat4 out);
+void mat4_fill(mat4 out, kf_scalar value);
+void mat4_copy(mat4 dst, const mat4 src);
+
+// out = a * b
+void mat4_mult(const mat4 a, const mat4 b, mat4 out);
+// out = a * b^T
+void mat4_mult_transpose(const mat4 a, const mat4 b, mat4 out);
+// a += b (in place)
+void mat4_add(mat4 a, const mat4 b);
+// a -= b (in place)
+void mat4_sub(mat4 a, const mat4 b);
+// a *= scaler (in place)
+void mat4_scale(mat4 a, kf_scalar scaler);
+// out = inverse(a), returns -1 (and leaves out untouched) if a is singular
+int mat4_inverse(const mat4 a, mat4 out);
+
+// out = a * v
+void mat4_vec_mult(const mat4 a, const vec4 v, vec4 out);
+// out = a + b (out may alias a or b)
+void vec4_add(const vec4 a, const vec4 b, vec4 out);
+// out = a - b (out may alias a or b)
+void vec4_sub(const vec4 a, const vec4 b, vec4 out);
+
+#endif
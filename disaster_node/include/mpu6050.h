@@ -0,0 +1,70 @@
+#ifndef MPU6050_H
+#define MPU6050_H
+
+#include <stdint.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/sys/util.h>
+
+/*
+* Register-level access to the MPU6050 for the paths the Zephyr sensor
+* driver does not offer, such as reading its FIFO in bursts. The sensor
+* driver still probes and wakes the part; these calls then reprogram it.
+* REF: MPU-6000/MPU-6050 Register Map and Descriptions, rev 4.2
+*/
+#define MPU6050_SMPLRT_DIV   0x19
+#define MPU6050_CONFIG       0x1A
+#define MPU6050_ACCEL_CONFIG 0x1C
+#define MPU6050_MOT_THR      0x1F
+#define MPU6050_MOT_DUR      0x20
+#define MPU6050_FIFO_EN      0x23
+#define MPU6050_INT_PIN_CFG  0x37
+#define MPU6050_INT_ENABLE   0x38
+#define MPU6050_INT_STATUS   0x3A
+#define MPU6050_USER_CTRL    0x6A
+#define MPU6050_PWR_MGMT_1   0x6B
+#define MPU6050_PWR_MGMT_2   0x6C
+#define MPU6050_FIFO_COUNTH  0x72
+#define MPU6050_FIFO_R_W     0x74
+
+// FIFO_EN: accelerometer x, y, z into the FIFO
+#define MPU6050_FIFO_EN_ACCEL BIT(3)
+// USER_CTRL
+#define MPU6050_USER_CTRL_FIFO_EN    BIT(6)
+#define MPU6050_USER_CTRL_FIFO_RESET BIT(2)
+// ACCEL_CONFIG: high pass filter of the motion detector holding its
+// reference at the sample taken when set (ACCEL_HPF, register map rev 3.2)
+#define MPU6050_ACCEL_CONFIG_HPF_HOLD 0x07
+// INT_PIN_CFG: INT stays high until INT_STATUS is read
+#define MPU6050_INT_PIN_CFG_LATCH BIT(5)
+// INT_ENABLE and INT_STATUS: motion detected
+#define MPU6050_INT_MOT BIT(6)
+// PWR_MGMT_1: sleep between single samples at the LP_WAKE_CTRL rate, and
+// the temperature sensor off
+#define MPU6050_PWR_MGMT_1_CYCLE    BIT(5)
+#define MPU6050_PWR_MGMT_1_TEMP_DIS BIT(3)
+// PWR_MGMT_2: all three gyro axes in standby, and the cycle mode wake-up
+// rate (LP_WAKE_CTRL) in the top two bits
+#define MPU6050_PWR_MGMT_2_STBY_GYRO 0x07
+#define MPU6050_PWR_MGMT_2_LP_WAKE_SHIFT 6
+// MOT_THR counts 2 mg and MOT_DUR 1 ms
+#define MPU6050_MOT_THR_MG 2
+
+// FIFO capacity, and the bytes of one accelerometer sample in it
+#define MPU6050_FIFO_SIZE 1024
+#define MPU6050_FIFO_SAMPLE_SIZE 6
+// raw counts per g at the +-2 g range used by the FIFO path
+#define MPU6050_COUNTS_PER_G 16384
+
+// put the accelerometer alone into the FIFO at about rate_hz (4..1000),
+// reporting the exact sample period
+int mpu6050_fifo_start(const struct i2c_dt_spec* bus, uint32_t rate_hz, uint32_t* period_us);
+// burst read up to max samples, reporting how many are left in the FIFO
+int mpu6050_fifo_read(const struct i2c_dt_spec* bus, int16_t (*xyz)[3], int max, int* pending);
+// sleep the accelerometer in cycle mode, latching INT high on motion above
+// threshold_mg for duration_ms
+int mpu6050_motion_arm(const struct i2c_dt_spec* bus, uint32_t threshold_mg, uint32_t duration_ms,
+    uint32_t wake_hz);
+// read and clear the interrupt status, releasing a latched INT
+int mpu6050_motion_clear(const struct i2c_dt_spec* bus, uint8_t* status);
+
+#endif
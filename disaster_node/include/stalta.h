@@ -0,0 +1,47 @@
+#ifndef STALTA_H
+#define STALTA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+* Short-term/long-term average (STA/LTA) trigger for a stream of integer
+* samples (e.g. distances in mm). Each sample contributes the square of its
+* change from the previous one, so a sensor's fixed offset does not matter,
+* and the trigger fires when the mean over the last CONFIG_STALTA_STA_SAMPLES
+* exceeds CONFIG_STALTA_TRIGGER_MILLI / 1000 times the mean over the last
+* CONFIG_STALTA_LTA_SAMPLES. It re-arms once the ratio falls below
+* CONFIG_STALTA_DETRIGGER_MILLI / 1000.
+*
+* Both windows are running sums over one ring buffer, so each sample costs
+* O(1) regardless of the window lengths. All arithmetic is integer, so the
+* sums never drift.
+*/
+#define STALTA_STA_SAMPLES CONFIG_STALTA_STA_SAMPLES
+#define STALTA_LTA_SAMPLES CONFIG_STALTA_LTA_SAMPLES
+
+#if STALTA_STA_SAMPLES >= STALTA_LTA_SAMPLES
+#error "CONFIG_STALTA_STA_SAMPLES must be shorter than CONFIG_STALTA_LTA_SAMPLES"
+#endif
+
+enum stalta_event {
+        STALTA_NONE,
+        STALTA_TRIGGER,   // ratio rose through the trigger threshold
+        STALTA_DETRIGGER, // ratio fell through the detrigger threshold
+};
+
+struct stalta {
+        uint32_t ring[STALTA_LTA_SAMPLES]; // squared change of each sample
+        uint16_t head;                     // slot of the next sample
+        uint16_t count;                    // samples seen, up to the LTA window
+        uint64_t sta_sum;
+        uint64_t lta_sum;
+        int32_t last;                      // previous sample
+        bool triggered;
+};
+
+void stalta_init(struct stalta* detector);
+// feed one sample, returns whether the trigger fired or re-armed
+enum stalta_event stalta_update(struct stalta* detector, int32_t sample);
+
+#endif
@@ -0,0 +1,366 @@
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#ifdef CONFIG_ACCEL_MOTION_WAKE
+#include <zephyr/drivers/gpio.h>
+#endif
+#include <stdio.h>
+
+#include "accel.h"
+#include "accel_fixed.h"
+#ifdef CONFIG_CAPTURE
+#include "capture.h"
+#endif
+#ifdef CONFIG_ACCEL_FIFO
+#include "mpu6050.h"
+#endif
+#ifdef CONFIG_ACCEL_BANDS
+#include "band_energy.h"
+#endif
+
+// readings averaged at start-up, while the node is at rest, for the bias
+#define BIAS_SAMPLES 64
+
+#define MPU6050_NODE DT_ALIAS(accel0)
+
+// fall and shaking detectors, fed by whichever path samples
+static struct accel_fixed detect;
+
+#ifdef CONFIG_ACCEL_FIFO
+static accel_block_handler block_handlers[ACCEL_BLOCK_HANDLERS];
+static int block_handler_count;
+#endif
+
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+// acceleration samples for the kalman filter. Samples are copied in, so
+// unlike the sensor fifos nothing is allocated per sample.
+K_MSGQ_DEFINE(kalman_accel_msgq, sizeof(struct accel_sample), ACCEL_QUEUE_DEPTH, 8);
+#endif
+
+/*
+* accel_put()
+* queue a sample for the filter, discarding the oldest queued sample if the
+* filter has fallen behind so it always sees the most recent acceleration.
+*/
+static void accel_put(const struct accel_sample* sample)
+{
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+    struct accel_sample oldest;
+
+    while (k_msgq_put(&kalman_accel_msgq, sample, K_NO_WAIT) != 0) {
+        k_msgq_get(&kalman_accel_msgq, &oldest, K_NO_WAIT);
+    }
+#endif
+}
+
+/*
+* report()
+* print the detector events raised by a sample or block.
+*/
+static void report(int events)
+{
+    if (events & ACCEL_FELL) {
+        printf("FELL OVER!!!\n");
+    }
+    if (events & ACCEL_SHAKE_START) {
+        printf("SHAKING\n");
+    }
+    if (events & ACCEL_SHAKE_STOP) {
+        printf("Shaking stopped\n");
+    }
+}
+
+#ifndef CONFIG_ACCEL_FIFO
+/*
+* process_mpu6050()
+* fetch one acceleration reading into xyz (micro m/s^2) and run it through
+* the detectors. Returns the sensor API error, 0 on success.
+* REF: accelerometer/main.c
+*/
+static int process_mpu6050(const struct device* dev, int64_t* timestamp, int32_t xyz[3])
+{
+    struct sensor_value accel[3];
+    int rc = sensor_sample_fetch(dev);
+
+    *timestamp = k_uptime_ticks();
+    if (rc == 0) {
+        rc = sensor_channel_get(dev, SENSOR_CHAN_ACCEL_XYZ, accel);
+    }
+    if (rc != 0) {
+        printf("sample fetch/get failed: %d\n", rc);
+        return rc;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        xyz[axis] = accel_fixed_from_sensor(&accel[axis]);
+    }
+    report(accel_fixed_update(&detect, xyz));
+#ifdef CONFIG_CAPTURE
+    capture_accel(*timestamp, xyz);
+#endif
+    return 0;
+}
+
+/*
+* accel_poll()
+* sample the MPU6050 through the sensor driver every CONFIG_ACCEL_PERIOD_MS,
+* warning if the node falls over or shakes and passing the x and y
+* acceleration to the kalman filter. The bias at rest (tilt, offsets) is
+* measured first and removed from every sample.
+*/
+static void accel_poll(const struct device* mpu6050)
+{
+    struct accel_sample sample;
+    int32_t xyz[3];
+    int64_t bias_sum[2] = {0, 0};
+
+    for (int n = 0; n < BIAS_SAMPLES; ) {
+        if (process_mpu6050(mpu6050, &sample.timestamp, xyz) == 0) {
+            bias_sum[0] += xyz[0];
+            bias_sum[1] += xyz[1];
+            n++;
+        }
+        k_msleep(CONFIG_ACCEL_PERIOD_MS);
+    }
+    const int32_t bias_x = bias_sum[0] / BIAS_SAMPLES;
+    const int32_t bias_y = bias_sum[1] / BIAS_SAMPLES;
+
+    while (1) {
+        if (process_mpu6050(mpu6050, &sample.timestamp, xyz) == 0) {
+            sample.ax = xyz[0] - bias_x;
+            sample.ay = xyz[1] - bias_y;
+            accel_put(&sample);
+        }
+        k_msleep(CONFIG_ACCEL_PERIOD_MS);
+    }
+}
+#endif
+
+#ifdef CONFIG_ACCEL_FIFO
+/*
+* accel_add_block_handler()
+* have handler called with every block of FIFO samples. Handlers run in the
+* accelerometer thread and must copy out what they need rather than block.
+* Register them before the thread starts. Returns -ENOMEM if the table of
+* ACCEL_BLOCK_HANDLERS is full.
+*/
+int accel_add_block_handler(accel_block_handler handler)
+{
+    if (block_handler_count >= ACCEL_BLOCK_HANDLERS) {
+        return -ENOMEM;
+    }
+    block_handlers[block_handler_count++] = handler;
+    return 0;
+}
+
+/*
+* process_block()
+* the thread's own consumer of FIFO blocks: run every sample through the
+* detectors, and pass the mean x and y acceleration of the block to the
+* kalman filter, so it predicts once per block rather than per sample.
+* The first BIAS_SAMPLES samples measure the bias at rest. The detectors
+* start afresh after a gap.
+*/
+static void process_block(const struct accel_block* block)
+{
+    static int64_t bias_sum[2];
+    static int bias_count;
+    static int32_t bias[2];
+    int64_t sum[2] = {0, 0};
+    int events = 0;
+
+    if (block->gap) {
+        accel_fixed_init(&detect);
+    }
+    for (int i = 0; i < block->count; i++) {
+        int32_t xyz[3];
+
+        for (int axis = 0; axis < 3; axis++) {
+            xyz[axis] = accel_fixed_from_counts(block->xyz[i][axis]);
+        }
+        events |= accel_fixed_update(&detect, xyz);
+#ifdef CONFIG_CAPTURE
+        capture_accel(block->timestamp + k_us_to_ticks_near64((uint64_t)i * block->period_us), xyz);
+#endif
+        sum[0] += xyz[0];
+        sum[1] += xyz[1];
+    }
+    report(events);
+
+    if (bias_count < BIAS_SAMPLES) {
+        bias_sum[0] += sum[0];
+        bias_sum[1] += sum[1];
+        bias_count += block->count;
+        if (bias_count >= BIAS_SAMPLES) {
+            bias[0] = bias_sum[0] / bias_count;
+            bias[1] = bias_sum[1] / bias_count;
+        }
+        return;
+    }
+
+    // the mean acts at the middle of the block
+    struct accel_sample sample = {
+        .timestamp = block->timestamp
+            + k_us_to_ticks_near64((uint64_t)(block->count - 1) * block->period_us / 2),
+        .ax = sum[0] / block->count - bias[0],
+        .ay = sum[1] / block->count - bias[1],
+    };
+    accel_put(&sample);
+}
+
+/*
+* fifo_capture()
+* read the running FIFO a block of CONFIG_ACCEL_FIFO_BLOCK samples at a
+* time, each in one I2C burst, handing every block to the registered
+* handlers, for window_ms or forever if it is 0. The MPU6050 has no FIFO
+* watermark interrupt, so a timer wakes the thread when a block is due.
+*/
+static void fifo_capture(const struct i2c_dt_spec* bus, struct accel_block* block, uint32_t window_ms)
+{
+    const int64_t end = k_uptime_get() + window_ms;
+    struct k_timer timer;
+    int pending;
+
+    k_timer_init(&timer, NULL, NULL);
+    k_timer_start(&timer, K_USEC(block->period_us * ACCEL_BLOCK_SAMPLES),
+        K_USEC(block->period_us * ACCEL_BLOCK_SAMPLES));
+
+    while (window_ms == 0 || k_uptime_get() < end) {
+        k_timer_status_sync(&timer);
+        // catch up straight away if a block or more is still queued
+        do {
+            int count = mpu6050_fifo_read(bus, block->xyz, ACCEL_BLOCK_SAMPLES, &pending);
+            // the newest queued sample was taken about now
+            int64_t now = k_uptime_ticks();
+
+            if (count == -EOVERFLOW) {
+                block->gap = true;
+                printf("MPU6050 FIFO overflow\n");
+            } else if (count < 0) {
+                printf("MPU6050 FIFO read failed: %d\n", count);
+            }
+            if (count <= 0) {
+                break;
+            }
+            block->count = count;
+            block->timestamp = now
+                - k_us_to_ticks_near64((uint64_t)(count + pending - 1) * block->period_us);
+            for (int i = 0; i < block_handler_count; i++) {
+                block_handlers[i](block);
+            }
+            block->gap = false;
+        } while (pending >= ACCEL_BLOCK_SAMPLES);
+    }
+    k_timer_stop(&timer);
+}
+
+#ifdef CONFIG_ACCEL_MOTION_WAKE
+BUILD_ASSERT(DT_NODE_HAS_PROP(MPU6050_NODE, int_gpios),
+    "CONFIG_ACCEL_MOTION_WAKE needs int-gpios on the accel0 node");
+
+static K_SEM_DEFINE(motion, 0, 1);
+
+/*
+* motion_isr()
+* GPIO callback for the MPU6050 INT pin, wakes the accelerometer thread.
+*/
+static void motion_isr(const struct device* port, struct gpio_callback* callback, uint32_t pins)
+{
+    k_sem_give(&motion);
+}
+
+/*
+* motion_wake()
+* alternate between a CONFIG_ACCEL_WAKE_WINDOW_MS capture through the FIFO
+* and sleep in the MPU6050's low power cycle mode, with the thread blocked
+* until the motion interrupt fires. The first window, straight after boot,
+* is where process_block() measures the bias at rest. Samples are lost
+* while asleep, so the first block of every window is marked as a gap.
+*/
+static void motion_wake(const struct i2c_dt_spec* bus, struct accel_block* block)
+{
+    static const struct gpio_dt_spec irq = GPIO_DT_SPEC_GET(MPU6050_NODE, int_gpios);
+    static struct gpio_callback callback;
+    uint8_t status;
+
+    if (!gpio_is_ready_dt(&irq) || gpio_pin_configure_dt(&irq, GPIO_INPUT) != 0
+        || gpio_pin_interrupt_configure_dt(&irq, GPIO_INT_EDGE_TO_ACTIVE) != 0) {
+        printf("MPU6050 INT pin setup failed\n");
+        return;
+    }
+    gpio_init_callback(&callback, motion_isr, BIT(irq.pin));
+    gpio_add_callback(irq.port, &callback);
+
+    while (1) {
+        fifo_capture(bus, block, CONFIG_ACCEL_WAKE_WINDOW_MS);
+
+        k_sem_reset(&motion);
+        if (mpu6050_motion_arm(bus, CONFIG_ACCEL_WAKE_THRESHOLD_MG, CONFIG_ACCEL_WAKE_DURATION_MS,
+                CONFIG_ACCEL_WAKE_RATE_HZ) != 0) {
+            printf("MPU6050 motion wake setup failed\n");
+            return;
+        }
+        k_sem_take(&motion, K_FOREVER);
+
+        if (mpu6050_motion_clear(bus, &status) != 0
+            || mpu6050_fifo_start(bus, CONFIG_ACCEL_FIFO_RATE_HZ, &block->period_us) != 0) {
+            printf("MPU6050 FIFO setup failed\n");
+            return;
+        }
+        block->gap = true;
+        printf("Motion wake\n");
+    }
+}
+#endif
+
+/*
+* accel_fifo()
+* sample the MPU6050 at CONFIG_ACCEL_FIFO_RATE_HZ into its FIFO and hand the
+* blocks read from it to the registered handlers, continuously or, with
+* CONFIG_ACCEL_MOTION_WAKE, only for a window after each motion interrupt.
+*/
+static void accel_fifo(void)
+{
+    static const struct i2c_dt_spec bus = I2C_DT_SPEC_GET(MPU6050_NODE);
+    static struct accel_block block;
+
+    if (!i2c_is_ready_dt(&bus) || mpu6050_fifo_start(&bus, CONFIG_ACCEL_FIFO_RATE_HZ, &block.period_us) != 0) {
+        printf("MPU6050 FIFO setup failed\n");
+        return;
+    }
+    accel_add_block_handler(process_block);
+#ifdef CONFIG_ACCEL_BANDS
+    if (band_energy_init(block.period_us) == 0) {
+        accel_add_block_handler(band_energy_block);
+    } else {
+        printf("Bad CONFIG_ACCEL_BANDS_EDGES, band energy disabled\n");
+    }
+#endif
+
+#ifdef CONFIG_ACCEL_MOTION_WAKE
+    motion_wake(&bus, &block);
+#else
+    fifo_capture(&bus, &block, 0);
+#endif
+}
+#endif
+
+/*
+* accelerometer()
+* thread function sampling the MPU6050, through its FIFO in blocks if
+* CONFIG_ACCEL_FIFO is set or else one reading at a time.
+*/
+void accelerometer()
+{
+    const struct device* const mpu6050 = DEVICE_DT_GET(MPU6050_NODE);
+
+    // the driver probes and wakes the part for either path
+    if (!device_is_ready(mpu6050)) {
+        printf("Device %s is not ready\n", mpu6050->name);
+        return;
+    }
+#ifdef CONFIG_ACCEL_FIFO
+    accel_fifo();
+#else
+    accel_poll(mpu6050);
+#endif
+}
@@ -0,0 +1,68 @@
+#include <string.h>
+
+#include "accel_fixed.h"
+
+// readings (m/s^2) beyond which the node is taken to have fallen over
+#define X_THRESHOLD 10
+#define Y_THRESHOLD 10
+#define Z_THRESHOLD 12
+
+// squared dynamic acceleration (micro m/s^2)^2 starting and ending shaking,
+// with hysteresis so a reading hovering at the threshold is one event
+#define SHAKE_START ((int64_t)CONFIG_ACCEL_SHAKE_MM_S2 * 1000 * CONFIG_ACCEL_SHAKE_MM_S2 * 1000)
+#define SHAKE_STOP (SHAKE_START / 4)
+
+/*
+* accel_fixed_init()
+* reset the detectors; the first reading primes the gravity estimate.
+*/
+void accel_fixed_init(struct accel_fixed* state)
+{
+    memset(state, 0, sizeof(*state));
+}
+
+/*
+* accel_fixed_update()
+* check one reading (micro m/s^2 per axis) against the fall thresholds and
+* track gravity with gravity += (reading - gravity) / 2^CONFIG_ACCEL_GRAVITY_SHIFT,
+* a low pass with a time constant of 2^CONFIG_ACCEL_GRAVITY_SHIFT samples.
+* The reading less gravity is the dynamic acceleration. Its squared
+* magnitude passes through zero twice a cycle of shaking, so it is
+* compared with the threshold through a peak envelope decaying with the
+* same time constant. Returns the ACCEL_* events raised.
+*/
+int accel_fixed_update(struct accel_fixed* state, const int32_t xyz[3])
+{
+    static const int32_t fall[3] = {
+        X_THRESHOLD * ACCEL_MICRO,
+        Y_THRESHOLD * ACCEL_MICRO,
+        Z_THRESHOLD * ACCEL_MICRO,
+    };
+    int64_t magnitude_sq = 0;
+    int events = 0;
+
+    if (!state->primed) {
+        memcpy(state->gravity, xyz, sizeof(state->gravity));
+        state->primed = true;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        int32_t dynamic = xyz[axis] - state->gravity[axis];
+
+        if (xyz[axis] > fall[axis]) {
+            events |= ACCEL_FELL;
+        }
+        state->gravity[axis] += dynamic / (1 << CONFIG_ACCEL_GRAVITY_SHIFT);
+        magnitude_sq += (int64_t)dynamic * dynamic;
+    }
+    state->envelope -= state->envelope >> CONFIG_ACCEL_GRAVITY_SHIFT;
+    state->envelope = MAX(state->envelope, magnitude_sq);
+
+    if (!state->shaking && state->envelope > SHAKE_START) {
+        state->shaking = true;
+        events |= ACCEL_SHAKE_START;
+    } else if (state->shaking && state->envelope < SHAKE_STOP) {
+        state->shaking = false;
+        events |= ACCEL_SHAKE_STOP;
+    }
+    return events;
+}
@@ -0,0 +1,349 @@
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#ifdef CONFIG_ACCEL_BANDS_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+#include "band_energy.h"
+#include "kalman.h"
+#include "mpu6050.h"
+#ifdef CONFIG_CAPTURE
+#include "capture.h"
+#endif
+
+#define FFT_SIZE BAND_ENERGY_FFT_SIZE
+// frames overlap by half
+#define HOP (FFT_SIZE / 2)
+// one-sided spectrum, DC to Nyquist
+#define BINS (FFT_SIZE / 2 + 1)
+#define NO_BAND 0xFF
+#define GRAVITY 9.80665f
+
+// Hann window, and the sum of its squares for the power scaling
+static float window[FFT_SIZE];
+static float window_power;
+// band of each bin, or NO_BAND, and the first bin above the seismic range
+static uint8_t bin_band[BINS];
+static int band_count;
+static int seismic_limit;
+// m/s^2 per raw count, averaged over a decimation
+static float count_scale;
+
+// decimated samples of the frame being filled, per axis
+static float frame[3][FFT_SIZE];
+static int frame_fill;
+static int64_t frame_start;
+static int64_t hop_ticks;
+// raw samples summed towards the next decimated sample
+static int32_t decim_sum[3];
+static int decim_fill;
+
+static float work[FFT_SIZE];
+#ifdef CONFIG_ACCEL_BANDS_CMSIS_DSP
+static arm_rfft_fast_instance_f32 rfft_instance;
+static float spectrum[FFT_SIZE];
+#else
+// e^(-2*pi*i*k/FFT_SIZE) for k < FFT_SIZE / 2
+static float twiddle_re[FFT_SIZE / 2];
+static float twiddle_im[FFT_SIZE / 2];
+#endif
+
+static atomic_t seismic;
+static int seismic_frames;
+static bool alarm_raised;
+
+#ifndef CONFIG_ACCEL_BANDS_CMSIS_DSP
+/*
+* rfft()
+* in-place FFT of FFT_SIZE real samples, packed as arm_rfft_fast_f32() packs
+* its output: buf[0] = X[0] and buf[1] = X[N/2] (both real), followed by the
+* real and imaginary parts of X[1..N/2-1]. The samples are transformed as
+* N/2 complex values with an iterative radix-2 FFT, then split into the
+* spectrum of the real sequence.
+* REF: Sorensen et al., Real-valued fast Fourier transform algorithms, 1987
+*/
+static void rfft(float* buf)
+{
+    const int m = FFT_SIZE / 2;
+
+    // bit-reversed order of the complex pairs
+    for (int i = 1, j = 0; i < m; i++) {
+        int bit = m >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float re = buf[2 * i];
+            float im = buf[2 * i + 1];
+            buf[2 * i] = buf[2 * j];
+            buf[2 * i + 1] = buf[2 * j + 1];
+            buf[2 * j] = re;
+            buf[2 * j + 1] = im;
+        }
+    }
+    // butterflies, twiddle e^(-2*pi*i*k/len) = twiddle[k * FFT_SIZE / len]
+    for (int len = 2; len <= m; len <<= 1) {
+        int stride = FFT_SIZE / len;
+        for (int start = 0; start < m; start += len) {
+            for (int k = 0; k < len / 2; k++) {
+                float* a = &buf[2 * (start + k)];
+                float* b = &buf[2 * (start + k + len / 2)];
+                float wr = twiddle_re[k * stride];
+                float wi = twiddle_im[k * stride];
+                float tr = b[0] * wr - b[1] * wi;
+                float ti = b[0] * wi + b[1] * wr;
+
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+    // even samples E = (Z[k] + conj Z[m-k]) / 2, odd O = (Z[k] - conj Z[m-k]) / 2i,
+    // X[k] = E + W^k O and X[m-k] = conj(E - W^k O)
+    float z0_re = buf[0];
+    buf[0] = z0_re + buf[1];
+    buf[1] = z0_re - buf[1];
+    for (int k = 1; k <= m / 2; k++) {
+        int j = m - k;
+        float e_re = (buf[2 * k] + buf[2 * j]) / 2;
+        float e_im = (buf[2 * k + 1] - buf[2 * j + 1]) / 2;
+        float o_re = (buf[2 * k + 1] + buf[2 * j + 1]) / 2;
+        float o_im = (buf[2 * j] - buf[2 * k]) / 2;
+        float p_re = twiddle_re[k] * o_re - twiddle_im[k] * o_im;
+        float p_im = twiddle_re[k] * o_im + twiddle_im[k] * o_re;
+
+        buf[2 * k] = e_re + p_re;
+        buf[2 * k + 1] = e_im + p_im;
+        buf[2 * j] = e_re - p_re;
+        buf[2 * j + 1] = p_im - e_im;
+    }
+}
+#endif
+
+/*
+* transform()
+* real FFT of work, returning the packed spectrum.
+*/
+static const float* transform(void)
+{
+#ifdef CONFIG_ACCEL_BANDS_CMSIS_DSP
+    arm_rfft_fast_f32(&rfft_instance, work, spectrum, 0);
+    return spectrum;
+#else
+    rfft(work);
+    return work;
+#endif
+}
+
+/*
+* band_energy_init()
+* parse CONFIG_ACCEL_BANDS_EDGES (ascending frequencies in Hz, one band
+* between each pair) for samples period_us apart, and build the window,
+* twiddle and bin tables. Returns -EINVAL if the edges are not ascending
+* numbers or describe no band or too many, or if CMSIS-DSP has no real FFT
+* of this length.
+*/
+int band_energy_init(uint32_t period_us)
+{
+    float rate = 1e6f / ((float)period_us * CONFIG_ACCEL_BANDS_DECIMATION);
+    float edges[BAND_ENERGY_MAX_BANDS + 1];
+    const char* text = CONFIG_ACCEL_BANDS_EDGES;
+    int count = 0;
+
+    while (count <= BAND_ENERGY_MAX_BANDS) {
+        char* end;
+        float edge = strtof(text, &end);
+        if (end == text) {
+            break;
+        }
+        if (count > 0 && edge <= edges[count - 1]) {
+            return -EINVAL;
+        }
+        edges[count++] = edge;
+        text = end;
+    }
+    // anything left over is a bad edge or one too many
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    if (count < 2 || *text != '\0') {
+        return -EINVAL;
+    }
+    band_count = count - 1;
+
+    window_power = 0;
+    for (int i = 0; i < FFT_SIZE; i++) {
+        window[i] = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / FFT_SIZE);
+        window_power += window[i] * window[i];
+    }
+#ifdef CONFIG_ACCEL_BANDS_CMSIS_DSP
+    if (arm_rfft_fast_init_f32(&rfft_instance, FFT_SIZE) != ARM_MATH_SUCCESS) {
+        return -EINVAL;
+    }
+#else
+    for (int k = 0; k < FFT_SIZE / 2; k++) {
+        twiddle_re[k] = cosf(2 * (float)M_PI * k / FFT_SIZE);
+        twiddle_im[k] = -sinf(2 * (float)M_PI * k / FFT_SIZE);
+    }
+#endif
+    seismic_limit = BINS;
+    for (int k = 0; k < BINS; k++) {
+        float freq = k * rate / FFT_SIZE;
+
+        bin_band[k] = NO_BAND;
+        for (int b = 0; b < band_count; b++) {
+            if (freq >= edges[b] && freq < edges[b + 1]) {
+                bin_band[k] = b;
+            }
+        }
+        if (freq >= CONFIG_ACCEL_BANDS_SEISMIC_MAX_HZ && seismic_limit == BINS) {
+            seismic_limit = k;
+        }
+    }
+    count_scale = GRAVITY / MPU6050_COUNTS_PER_G / CONFIG_ACCEL_BANDS_DECIMATION;
+    hop_ticks = k_us_to_ticks_near64((uint64_t)HOP * CONFIG_ACCEL_BANDS_DECIMATION * period_us);
+    frame_fill = 0;
+    decim_fill = 0;
+    seismic_frames = 0;
+    alarm_raised = false;
+    atomic_set(&seismic, false);
+    return 0;
+}
+
+/*
+* report()
+* publish a frame's verdict. CONFIG_ACCEL_BANDS_ALARM_FRAMES seismic frames
+* in a row raise the earthquake alarm, and a quiet frame re-arms it.
+*/
+static void report(const struct band_energy_frame* result)
+{
+    atomic_set(&seismic, result->seismic);
+    if (!result->seismic) {
+        seismic_frames = 0;
+        alarm_raised = false;
+        return;
+    }
+    if (++seismic_frames < CONFIG_ACCEL_BANDS_ALARM_FRAMES || alarm_raised) {
+        return;
+    }
+    alarm_raised = true;
+    printf("!!!!!!!!!EARTHQUAKE!!!!!!!!!\n");
+    printf("band energy (m/s^2)^2:");
+    for (int b = 0; b < result->bands; b++) {
+        printf(" %g", (double)result->energy[b]);
+    }
+    printf("\n");
+#ifdef CONFIG_ACCEL_BANDS_ALARM
+    k_sem_give(&signal);
+#ifdef CONFIG_CAPTURE
+    capture_trigger();
+#endif
+#endif
+}
+
+/*
+* analyse_frame()
+* window each axis of the full frame with its mean removed, transform it
+* and sum the power of each bin into its band. DC is left out, so gravity
+* and tilt do not count.
+*/
+static void analyse_frame(void)
+{
+    // one-sided power as mean square acceleration of the frame
+    const float scale = 1.0f / (FFT_SIZE * window_power);
+    const float min_energy = (CONFIG_ACCEL_BANDS_MIN_RMS / 1000.0f) * (CONFIG_ACCEL_BANDS_MIN_RMS / 1000.0f);
+    struct band_energy_frame result = {
+        .timestamp = frame_start,
+        .bands = band_count,
+    };
+    float seismic_energy = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float mean = 0;
+
+        for (int i = 0; i < FFT_SIZE; i++) {
+            mean += frame[axis][i];
+        }
+        mean /= FFT_SIZE;
+        for (int i = 0; i < FFT_SIZE; i++) {
+            work[i] = (frame[axis][i] - mean) * window[i];
+        }
+        const float* spectrum_out = transform();
+
+        for (int k = 1; k < BINS; k++) {
+            float power;
+            if (k == BINS - 1) {
+                power = spectrum_out[1] * spectrum_out[1] * scale;
+            } else {
+                power = 2 * (spectrum_out[2 * k] * spectrum_out[2 * k]
+                    + spectrum_out[2 * k + 1] * spectrum_out[2 * k + 1]) * scale;
+            }
+            result.total += power;
+            if (bin_band[k] != NO_BAND) {
+                result.energy[bin_band[k]] += power;
+            }
+            if (k < seismic_limit) {
+                seismic_energy += power;
+            }
+        }
+    }
+    result.seismic = result.total >= min_energy
+        && seismic_energy * 100 >= result.total * CONFIG_ACCEL_BANDS_SEISMIC_PCT;
+    report(&result);
+}
+
+/*
+* band_energy_block()
+* accelerometer block handler: decimate the samples into the frame and
+* analyse it each time it fills, then keep its second half as the start of
+* the next. Samples lost to a FIFO overflow restart the frame.
+*/
+void band_energy_block(const struct accel_block* block)
+{
+    if (block->gap) {
+        frame_fill = 0;
+        decim_fill = 0;
+    }
+    for (int i = 0; i < block->count; i++) {
+        if (frame_fill == 0 && decim_fill == 0) {
+            frame_start = block->timestamp + k_us_to_ticks_near64((uint64_t)i * block->period_us);
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            decim_sum[axis] = (decim_fill == 0 ? 0 : decim_sum[axis]) + block->xyz[i][axis];
+        }
+        if (++decim_fill < CONFIG_ACCEL_BANDS_DECIMATION) {
+            continue;
+        }
+        decim_fill = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            frame[axis][frame_fill] = decim_sum[axis] * count_scale;
+        }
+        if (++frame_fill < FFT_SIZE) {
+            continue;
+        }
+        analyse_frame();
+        for (int axis = 0; axis < 3; axis++) {
+            memmove(frame[axis], frame[axis] + HOP, HOP * sizeof(float));
+        }
+        frame_fill = HOP;
+        frame_start += hop_ticks;
+    }
+}
+
+/*
+* band_energy_seismic()
+* whether the latest frame looked like an earthquake.
+*/
+bool band_energy_seismic(void)
+{
+    return atomic_get(&seismic);
+}
@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <stdio.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/util.h>
+
+#include "capture.h"
+
+// bytes of the blob printed per "cap," line
+#define DUMP_LINE_BYTES 32
+#define DUMP_STACK_SIZE 2048
+// below the sensor threads, printing an event takes a while
+#define DUMP_PRIORITY 10
+// how often to look again if the window has not closed when expected
+#define DUMP_RETRY_MS 100
+
+enum capture_state {
+        CAPTURE_ARMED,  // overwriting the oldest record
+        CAPTURE_POST,   // recording the post-trigger window
+        CAPTURE_FROZEN, // holding an event for export
+};
+
+static struct capture_record ring[CAPTURE_RECORDS];
+// slot of the next record, records held, and records since the trigger
+static uint32_t head;
+static uint32_t filled;
+static uint32_t post_count;
+static int64_t trigger_ticks;
+static enum capture_state state;
+static int accel_skip;
+static struct k_spinlock lock;
+#ifdef CONFIG_CAPTURE_DUMP
+// given when a trigger opens a post-trigger window
+static K_SEM_DEFINE(dump_pending, 0, 1);
+#endif
+
+/*
+* post_done()
+* whether the post-trigger window is over at now: its time is up, or
+* another record would leave less than half the ring before the trigger.
+* Called with the lock held.
+*/
+static bool post_done(int64_t now)
+{
+    return now - trigger_ticks >= k_ms_to_ticks_ceil64(CONFIG_CAPTURE_POST_MS)
+        || post_count >= CAPTURE_RECORDS / 2;
+}
+
+/*
+* saturate()
+* clamp a value into a record field.
+*/
+static int16_t saturate(int32_t v)
+{
+    return CLAMP(v, INT16_MIN, INT16_MAX);
+}
+
+/*
+* capture_add()
+* write a record taken at ticks, unless the ring is frozen. Freezes it
+* first if the post-trigger window has run out.
+*/
+void capture_add(int64_t ticks, enum capture_kind kind, uint8_t source, int32_t v0, int32_t v1, int32_t v2)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (state == CAPTURE_POST && post_done(ticks)) {
+        state = CAPTURE_FROZEN;
+    }
+    if (state != CAPTURE_FROZEN) {
+        struct capture_record* record = &ring[head];
+
+        record->ticks = (uint32_t)ticks;
+        record->kind = kind;
+        record->source = source;
+        record->value[0] = saturate(v0);
+        record->value[1] = saturate(v1);
+        record->value[2] = saturate(v2);
+        head = (head + 1) % CAPTURE_RECORDS;
+        filled = MIN(filled + 1, CAPTURE_RECORDS);
+        post_count += state == CAPTURE_POST;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+/*
+* capture_accel()
+* record one accelerometer sample (micro m/s^2 per axis) in every
+* CONFIG_CAPTURE_ACCEL_DECIMATION, so it does not crowd the slower sensors
+* out of the ring. Only called from the accelerometer thread.
+*/
+void capture_accel(int64_t ticks, const int32_t xyz[3])
+{
+    if (accel_skip-- > 0) {
+        return;
+    }
+    accel_skip = CONFIG_CAPTURE_ACCEL_DECIMATION - 1;
+    capture_add(ticks, CAPTURE_ACCEL, 0, xyz[0] / 1000, xyz[1] / 1000, xyz[2] / 1000);
+}
+
+/*
+* capture_trigger()
+* start the post-trigger window now. A trigger while a window is running
+* or an event is frozen belongs to that event and is ignored.
+*/
+void capture_trigger(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (state == CAPTURE_ARMED) {
+        state = CAPTURE_POST;
+        post_count = 0;
+        trigger_ticks = k_uptime_ticks();
+#ifdef CONFIG_CAPTURE_DUMP
+        k_sem_give(&dump_pending);
+#endif
+    }
+    k_spin_unlock(&lock, key);
+}
+
+/*
+* capture_frozen()
+* whether an event is ready for capture_export(). Also freezes the ring
+* if the window ran out with no records arriving to notice.
+*/
+bool capture_frozen(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (state == CAPTURE_POST && post_done(k_uptime_ticks())) {
+        state = CAPTURE_FROZEN;
+    }
+    bool frozen = state == CAPTURE_FROZEN;
+
+    k_spin_unlock(&lock, key);
+    return frozen;
+}
+
+/*
+* capture_export()
+* stream the frozen event to write: the header, then the records oldest
+* first, in at most two writes straight from the ring. Nothing is written
+* to the ring while it is frozen, so no copy is needed. Returns 0, -EBUSY
+* if no event is frozen, or the first error from write.
+*/
+int capture_export(capture_write_fn write, void* ctx)
+{
+    if (!capture_frozen()) {
+        return -EBUSY;
+    }
+    uint32_t count = filled;
+    uint32_t oldest = (head + CAPTURE_RECORDS - count) % CAPTURE_RECORDS;
+    // records from the oldest to the end of the array, then from the start
+    uint32_t first = MIN(count, CAPTURE_RECORDS - oldest);
+    const struct capture_header header = {
+        .trigger_ticks = trigger_ticks,
+        .magic = CAPTURE_MAGIC,
+        .version = CAPTURE_VERSION,
+        .record_size = sizeof(struct capture_record),
+        .ticks_per_sec = CONFIG_SYS_CLOCK_TICKS_PER_SEC,
+        .count = count,
+        .trigger = count - post_count,
+        .accel_decimation = CONFIG_CAPTURE_ACCEL_DECIMATION,
+    };
+    int rc = write(&header, sizeof(header), ctx);
+
+    if (rc == 0) {
+        rc = write(&ring[oldest], first * sizeof(ring[0]), ctx);
+    }
+    if (rc == 0 && first < count) {
+        rc = write(&ring[0], (count - first) * sizeof(ring[0]), ctx);
+    }
+    return rc;
+}
+
+/*
+* capture_rearm()
+* drop the frozen event and start filling the ring again.
+*/
+void capture_rearm(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    head = 0;
+    filled = 0;
+    state = CAPTURE_ARMED;
+    k_spin_unlock(&lock, key);
+}
+
+#ifdef CONFIG_CAPTURE_DUMP
+// bytes of the current "cap," line so far, shared by dump_write() calls
+struct dump_line {
+        uint8_t bytes[DUMP_LINE_BYTES];
+        int len;
+};
+
+/*
+* dump_flush()
+* print a "cap,<hex>" line of the bytes gathered, if any.
+*/
+static void dump_flush(struct dump_line* line)
+{
+    char hex[DUMP_LINE_BYTES * 2 + 1];
+
+    for (int i = 0; i < line->len; i++) {
+        snprintf(&hex[2 * i], 3, "%02x", line->bytes[i]);
+    }
+    hex[2 * line->len] = '\0';
+    if (line->len > 0) {
+        printf("cap,%s\n", hex);
+    }
+    line->len = 0;
+}
+
+/*
+* dump_write()
+* capture_export() sink gathering the blob into whole lines.
+*/
+static int dump_write(const void* data, size_t len, void* ctx)
+{
+    struct dump_line* line = ctx;
+    const uint8_t* bytes = data;
+
+    for (size_t i = 0; i < len; i++) {
+        line->bytes[line->len++] = bytes[i];
+        if (line->len == DUMP_LINE_BYTES) {
+            dump_flush(line);
+        }
+    }
+    return 0;
+}
+
+/*
+* capture_dump()
+* thread printing each event once its post-trigger window is over, between
+* "cap,begin" and "cap,end" as hex lines of the blob for the gateway
+* (piSDR/Capture_Decode.py), then re-arming for the next.
+*/
+static void capture_dump(void* p1, void* p2, void* p3)
+{
+    while (1) {
+        struct dump_line line = {.len = 0};
+
+        k_sem_take(&dump_pending, K_FOREVER);
+        k_msleep(CONFIG_CAPTURE_POST_MS);
+        while (!capture_frozen()) {
+            k_msleep(DUMP_RETRY_MS);
+        }
+        printf("cap,begin\n");
+        capture_export(dump_write, &line);
+        dump_flush(&line);
+        printf("cap,end\n");
+        capture_rearm();
+    }
+}
+
+K_THREAD_DEFINE(capture_dump_id, DUMP_STACK_SIZE,
+    capture_dump, NULL, NULL, NULL,
+    DUMP_PRIORITY, 0, 0);
+#endif
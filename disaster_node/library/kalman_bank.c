@@ -0,0 +1,229 @@
+#include <string.h>
+#include "kalman_bank.h"
+
+/*
+* kalman_bank_init()
+* empty a bank. proc_err is the process noise per second and meas_err the
+* error of each position observation, shared by every target.
+*/
+void kalman_bank_init(struct kalman_bank* bank, kf_scalar proc_err, kf_scalar meas_err)
+{
+    memset(bank, 0, sizeof(*bank));
+    bank->proc_err = proc_err;
+    bank->meas_err = meas_err;
+}
+
+/*
+* index_home()
+* index entry a target id hashes to (Fibonacci hashing).
+*/
+static uint32_t index_home(uint32_t id)
+{
+    return (uint32_t)(((uint64_t)(id * 2654435769u) * KALMAN_BANK_INDEX_SIZE) >> 32);
+}
+
+/*
+* index_find()
+* index entry holding target id, or the empty entry ending its probe run
+* with *found false.
+*/
+static uint32_t index_find(const struct kalman_bank* bank, uint32_t id, bool* found)
+{
+    uint32_t entry = index_home(id);
+
+    while (bank->index[entry] != 0) {
+        if (bank->id[bank->index[entry] - 1] == id) {
+            *found = true;
+            return entry;
+        }
+        entry = (entry + 1) % KALMAN_BANK_INDEX_SIZE;
+    }
+    *found = false;
+    return entry;
+}
+
+/*
+* index_delete()
+* empty an index entry, shifting later entries of the probe run back into
+* the hole so every target stays reachable from its home without
+* tombstones.
+*/
+static void index_delete(struct kalman_bank* bank, uint32_t hole)
+{
+    uint32_t entry = (hole + 1) % KALMAN_BANK_INDEX_SIZE;
+
+    while (bank->index[entry] != 0) {
+        uint32_t home = index_home(bank->id[bank->index[entry] - 1]);
+        // distance along the probe run from home to the entry and the hole
+        uint32_t to_entry = (entry + KALMAN_BANK_INDEX_SIZE - home) % KALMAN_BANK_INDEX_SIZE;
+        uint32_t to_hole = (hole + KALMAN_BANK_INDEX_SIZE - home) % KALMAN_BANK_INDEX_SIZE;
+
+        if (to_hole < to_entry) {
+            bank->index[hole] = bank->index[entry];
+            hole = entry;
+        }
+        entry = (entry + 1) % KALMAN_BANK_INDEX_SIZE;
+    }
+    bank->index[hole] = 0;
+}
+
+/*
+* kalman_bank_find()
+* slot holding target id, or -1 if it is not tracked.
+*/
+int kalman_bank_find(const struct kalman_bank* bank, uint32_t id)
+{
+    bool found;
+    uint32_t entry = index_find(bank, id, &found);
+
+    return found ? bank->index[entry] - 1 : -1;
+}
+
+/*
+* kalman_bank_add()
+* start tracking target id at (x, y) with zero velocity and init_err on the
+* diagonal of its covariance. Returns the slot used, or -1 if the bank is full
+* or the target is already tracked.
+*/
+int kalman_bank_add(struct kalman_bank* bank, uint32_t id, kf_scalar x, kf_scalar y, kf_scalar init_err)
+{
+    bool found;
+    uint32_t entry = index_find(bank, id, &found);
+
+    if (bank->count >= KALMAN_BANK_SIZE || found) {
+        return -1;
+    }
+    int slot = bank->count++;
+    const kf_scalar start[2] = {x, y};
+
+    bank->id[slot] = id;
+    bank->index[entry] = slot + 1;
+    bank->fresh[slot] = 0;
+    for (int axis = 0; axis < 2; axis++) {
+        bank->pos[axis][slot] = start[axis];
+        bank->vel[axis][slot] = 0;
+        bank->cov_pp[axis][slot] = init_err;
+        bank->cov_pv[axis][slot] = 0;
+        bank->cov_vv[axis][slot] = init_err;
+        // never left uninitialised, the update multiplies it out when stale
+        bank->obs[axis][slot] = start[axis];
+    }
+    return slot;
+}
+
+/*
+* kalman_bank_remove()
+* stop tracking target id. The last target is moved into its slot so the
+* slots in use stay contiguous, and its index entry updated to match.
+* Returns -1 if the target was not tracked.
+*/
+int kalman_bank_remove(struct kalman_bank* bank, uint32_t id)
+{
+    bool found;
+    uint32_t entry = index_find(bank, id, &found);
+
+    if (!found) {
+        return -1;
+    }
+    int slot = bank->index[entry] - 1;
+    int last = --bank->count;
+
+    index_delete(bank, entry);
+    if (slot != last) {
+        // the last target's entry follows it into the freed slot
+        bank->index[index_find(bank, bank->id[last], &found)] = slot + 1;
+    }
+    bank->id[slot] = bank->id[last];
+    bank->fresh[slot] = bank->fresh[last];
+    for (int axis = 0; axis < 2; axis++) {
+        bank->pos[axis][slot] = bank->pos[axis][last];
+        bank->vel[axis][slot] = bank->vel[axis][last];
+        bank->cov_pp[axis][slot] = bank->cov_pp[axis][last];
+        bank->cov_pv[axis][slot] = bank->cov_pv[axis][last];
+        bank->cov_vv[axis][slot] = bank->cov_vv[axis][last];
+        bank->obs[axis][slot] = bank->obs[axis][last];
+    }
+    return 0;
+}
+
+/*
+* kalman_bank_observe()
+* stage a position observation of target id, fused by the next
+* kalman_bank_update(). A later observation before then replaces it. Returns
+* -1 if the target is not tracked.
+*/
+int kalman_bank_observe(struct kalman_bank* bank, uint32_t id, kf_scalar x, kf_scalar y)
+{
+    int slot = kalman_bank_find(bank, id);
+
+    if (slot < 0) {
+        return -1;
+    }
+    bank->obs[KALMAN_BANK_X][slot] = x;
+    bank->obs[KALMAN_BANK_Y][slot] = y;
+    bank->fresh[slot] = 1;
+    return 0;
+}
+
+/*
+* kalman_bank_predict()
+* advance every target dt seconds: pos += dt * vel,
+* P = F * P * F^T + Q with F = [1 dt; 0 1] and Q = proc_err * dt * I.
+*/
+void kalman_bank_predict(struct kalman_bank* bank, kf_scalar dt)
+{
+    const kf_scalar q = bank->proc_err * dt;
+    const int count = bank->count;
+
+    for (int axis = 0; axis < 2; axis++) {
+        kf_scalar* pos = bank->pos[axis];
+        const kf_scalar* vel = bank->vel[axis];
+        kf_scalar* pp = bank->cov_pp[axis];
+        kf_scalar* pv = bank->cov_pv[axis];
+        kf_scalar* vv = bank->cov_vv[axis];
+
+        for (int i = 0; i < count; i++) {
+            pos[i] += dt * vel[i];
+            pp[i] += dt * (2 * pv[i] + dt * vv[i]) + q;
+            pv[i] += dt * vv[i];
+            vv[i] += q;
+        }
+    }
+}
+
+/*
+* kalman_bank_update()
+* fuse the staged observation of every slot as a scalar position
+* measurement per axis, then clear them. Slots without a fresh observation
+* get a zero gain rather than a branch, so the loop stays vectorizable.
+*/
+void kalman_bank_update(struct kalman_bank* bank)
+{
+    const kf_scalar r = bank->meas_err;
+    const int count = bank->count;
+    const kf_scalar* fresh = bank->fresh;
+
+    for (int axis = 0; axis < 2; axis++) {
+        const kf_scalar* obs = bank->obs[axis];
+        kf_scalar* pos = bank->pos[axis];
+        kf_scalar* vel = bank->vel[axis];
+        kf_scalar* pp = bank->cov_pp[axis];
+        kf_scalar* pv = bank->cov_pv[axis];
+        kf_scalar* vv = bank->cov_vv[axis];
+
+        for (int i = 0; i < count; i++) {
+            // K = fresh * [pp pv]^T / (pp + r), P -= K * [pp pv]
+            kf_scalar scale = fresh[i] / (pp[i] + r);
+            kf_scalar k_p = pp[i] * scale;
+            kf_scalar k_v = pv[i] * scale;
+            kf_scalar error = obs[i] - pos[i];
+
+            pos[i] += k_p * error;
+            vel[i] += k_v * error;
+            vv[i] -= k_v * pv[i];
+            pv[i] -= k_p * pv[i];
+            pp[i] -= k_p * pp[i];
+        }
+    }
+    memset(bank->fresh, 0, count * sizeof(bank->fresh[0]));
+}
@@ -0,0 +1,1419 @@
+#include <string.h>
+#include <math.h>
+#include "kalman_core.h"
+#include "kalman_port.h"
+#include "mat4.h"
+#include "kalman_gen.h"
+
+#ifdef CONFIG_KALMAN_UPDATE_UD
+// index of U[i][j] (i < j) or D[i] (i == j) in the packed upper triangle
+#define UD(i, j) ((i) * (9 - (i)) / 2 + (j) - (i))
+
+/*
+* ud_factor()
+* factor a symmetric positive definite cov into packed U and D.
+* REF: Bierman, Factorization Methods for Discrete Sequential Estimation
+*/
+static void ud_factor(const mat4 cov, kf_scalar* ud)
+{
+    for (int j = 3; j >= 0; j--) {
+        kf_scalar d = cov[j][j];
+        for (int k = j + 1; k < 4; k++) {
+            d -= ud[UD(k, k)] * ud[UD(j, k)] * ud[UD(j, k)];
+        }
+        ud[UD(j, j)] = d;
+
+        for (int i = 0; i < j; i++) {
+            kf_scalar u = cov[i][j];
+            for (int k = j + 1; k < 4; k++) {
+                u -= ud[UD(k, k)] * ud[UD(i, k)] * ud[UD(j, k)];
+            }
+            ud[UD(i, j)] = (d != 0) ? u / d : 0;
+        }
+    }
+}
+
+/*
+* ud_predict()
+* Thornton's time update: refactor A * U * D * U^T * A^T + Q into U and D
+* with a modified weighted Gram-Schmidt pass over the rows of [A*U | I],
+* weighted by [D | diag(Q)]. Never forms the covariance, so U stays unit
+* triangular and D positive.
+* REF: Thornton & Bierman, Gram-Schmidt algorithms for covariance propagation
+*/
+static void ud_predict(Kalman* filter)
+{
+    kf_scalar W[4][8];
+    kf_scalar weight[8];
+    kf_scalar* ud = filter->ud;
+
+    // W = [A * U | I], weight = [D | diag(Q)]
+    for (int i = 0; i < 4; i++) {
+        for (int k = 0; k < 4; k++) {
+            kf_scalar sum = filter->A[i][k];
+            for (int m = 0; m < k; m++) {
+                sum += filter->A[i][m] * ud[UD(m, k)];
+            }
+            W[i][k] = sum;
+            W[i][k + 4] = (i == k) ? 1 : 0;
+        }
+        weight[i] = ud[UD(i, i)];
+        weight[i + 4] = filter->Q[i][i];
+    }
+
+    for (int j = 3; j >= 0; j--) {
+        kf_scalar d = 0;
+        for (int k = 0; k < 8; k++) {
+            d += weight[k] * W[j][k] * W[j][k];
+        }
+        ud[UD(j, j)] = d;
+
+        for (int i = 0; i < j; i++) {
+            kf_scalar sum = 0;
+            for (int k = 0; k < 8; k++) {
+                sum += weight[k] * W[i][k] * W[j][k];
+            }
+            kf_scalar u = (d != 0) ? sum / d : 0;
+            ud[UD(i, j)] = u;
+            for (int k = 0; k < 8; k++) {
+                W[i][k] -= u * W[j][k];
+            }
+        }
+    }
+}
+
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_DECOUPLED
+// A, Q and the diagonal R never couple x and y, so each axis is an
+// independent (position, velocity) filter: x is state 0 with velocity state
+// 2, y is state 1 with velocity state 3. The symmetric 2x2 covariance of an
+// axis is stored as its three distinct entries.
+enum { AXIS_PP, AXIS_PV, AXIS_VV };
+
+/*
+* axis_predict()
+* per-axis time update: p += dt * v, P = F * P * F^T + Q with F = [1 dt; 0 1]
+*/
+static void axis_predict(Kalman* filter)
+{
+    kf_scalar dt = filter->dt;
+
+    for (int axis = 0; axis < 2; axis++) {
+        kf_scalar* p = filter->axis_cov[axis];
+
+        filter->x_hat[axis] += dt * filter->x_hat[axis + 2];
+        p[AXIS_PP] += dt * (2 * p[AXIS_PV] + dt * p[AXIS_VV])
+            + filter->Q[axis][axis];
+        p[AXIS_PV] += dt * p[AXIS_VV];
+        p[AXIS_VV] += filter->Q[axis + 2][axis + 2];
+    }
+}
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+/*
+* fixed_set_dt()
+* set the Q16.16 time step and the process noise diagonal scaled to it.
+*/
+static void fixed_set_dt(Kalman* filter, fix16 dt)
+{
+    filter->fx_dt = dt;
+    filter->fx_q = fix16_mul(filter->fx_proc_err, dt);
+}
+
+/*
+* fixed_predict()
+* Q16.16 time update. A is the identity plus dt coupling each position to
+* its velocity (states 2 and 3), so x_hat = A * x_hat adds dt * velocity and
+* A * cov * A^T adds dt times the velocity rows, then columns. Only the upper
+* triangle of the result is kept and mirrored so rounding cannot make the
+* covariance asymmetric.
+*/
+static void fixed_predict(Kalman* filter)
+{
+    fix16 dt = filter->fx_dt;
+    fix16 (*P)[4] = filter->fx_cov;
+
+    for (int i = 0; i < 2; i++) {
+        filter->fx_x[i] = fix16_add(filter->fx_x[i],
+            fix16_mul(dt, filter->fx_x[i + 2]));
+    }
+    // rows 2 and 3 (then columns 2 and 3) are left unchanged by each pass,
+    // so both can be done in place
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 4; j++) {
+            P[i][j] = fix16_add(P[i][j], fix16_mul(dt, P[i + 2][j]));
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 2; j++) {
+            P[i][j] = fix16_add(P[i][j], fix16_mul(dt, P[i][j + 2]));
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        P[i][i] = fix16_add(P[i][i], filter->fx_q);
+        for (int j = i + 1; j < 4; j++) {
+            P[j][i] = P[i][j];
+        }
+    }
+}
+#endif
+
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+/*
+* control_predict()
+* add the held acceleration u to the predicted state, x_hat += B * u with
+* B = [dt^2 / 2 * I; dt * I] (position, then velocity).
+*/
+static void control_predict(Kalman* filter)
+{
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    fix16 dt = filter->fx_dt;
+    fix16 half_dt2 = fix16_mul(dt, dt) / 2;
+
+    for (int axis = 0; axis < 2; axis++) {
+        filter->fx_x[axis] = fix16_add(filter->fx_x[axis],
+            fix16_mul(half_dt2, filter->fx_accel[axis]));
+        filter->fx_x[axis + 2] = fix16_add(filter->fx_x[axis + 2],
+            fix16_mul(dt, filter->fx_accel[axis]));
+    }
+#else
+    kf_scalar dt = filter->dt;
+
+    for (int axis = 0; axis < 2; axis++) {
+        filter->x_hat[axis] += dt * dt / 2 * filter->accel[axis];
+        filter->x_hat[axis + 2] += dt * filter->accel[axis];
+    }
+#endif
+}
+
+/*
+* kalman_set_control()
+* hold a new x and y acceleration (micro m/s^2) as the control input for the
+* following predictions.
+*/
+void kalman_set_control(Kalman* filter, int32_t ax, int32_t ay)
+{
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    filter->fx_accel[0] = fix16_from_ratio(ax, KALMAN_MICRO);
+    filter->fx_accel[1] = fix16_from_ratio(ay, KALMAN_MICRO);
+#else
+    filter->accel[0] = (kf_scalar)ax / KALMAN_MICRO;
+    filter->accel[1] = (kf_scalar)ay / KALMAN_MICRO;
+#endif
+}
+#endif
+
+/*
+* steady_gain_reset()
+* drop every cached steady-state gain so the next updates fall back to full
+* covariance propagation.
+*/
+static void steady_gain_reset(Kalman* filter)
+{
+#ifdef CONFIG_KALMAN_STEADY_STATE
+    memset(filter->gains, 0, sizeof(filter->gains));
+#else
+    (void)filter;
+#endif
+}
+
+#ifndef CONFIG_KALMAN_UPDATE_FIXED
+/*
+* kalman_set_dt()
+* set the time step (seconds), reload the state transition matrix for it
+* from the generated model and scale the process noise to match. A change
+* beyond the steady-state tolerance invalidates any steady-state gain, which
+* was only valid for the old step.
+*/
+void kalman_set_dt(Kalman* filter, double dt)
+{
+    kf_scalar old_dt = filter->dt;
+
+    if (old_dt == (kf_scalar)dt) {
+        return;
+    }
+    filter->dt = dt;
+    kalman_gen_transition(filter->A, filter->dt);
+    mat4_identity(filter->Q);
+    mat4_scale(filter->Q, filter->proc_err * dt);
+
+#ifdef CONFIG_KALMAN_STEADY_STATE
+    // sample timing jitter alone should not throw away a converged gain
+    kf_scalar change = (kf_scalar)dt - old_dt;
+    change = (change < 0) ? -change : change;
+    if (change * 100 > old_dt * CONFIG_KALMAN_STEADY_STATE_DT_TOLERANCE_PCT) {
+        steady_gain_reset(filter);
+    }
+#endif
+}
+#endif
+
+/*
+* kalman_set_dt_ticks()
+* kalman_set_dt() for a time step in kernel ticks. The fixed-point mode
+* converts it with integer arithmetic only.
+*/
+void kalman_set_dt_ticks(Kalman* filter, int64_t ticks)
+{
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    fix16 dt = fix16_from_ratio(ticks, KALMAN_TICKS_PER_SEC);
+
+    if (dt != filter->fx_dt) {
+        fixed_set_dt(filter, dt);
+    }
+#else
+    kalman_set_dt(filter, (double)ticks / KALMAN_TICKS_PER_SEC);
+#endif
+}
+
+/*
+* kalman_set_noise()
+* set the process noise (per second) and measurement error (R) matrix, all
+* in micro units. A change invalidates any steady-state gain.
+*/
+void kalman_set_noise(Kalman* filter, int32_t meas_err_rssi_x, int32_t meas_err_rssi_y, int32_t meas_err_us_x, int32_t meas_err_us_y, int32_t proc_err)
+{
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    filter->fx_r[0] = fix16_from_ratio(meas_err_us_x, KALMAN_MICRO);
+    filter->fx_r[1] = fix16_from_ratio(meas_err_us_y, KALMAN_MICRO);
+    filter->fx_r[2] = fix16_from_ratio(meas_err_rssi_x, KALMAN_MICRO);
+    filter->fx_r[3] = fix16_from_ratio(meas_err_rssi_y, KALMAN_MICRO);
+    filter->fx_proc_err = fix16_from_ratio(proc_err, KALMAN_MICRO);
+    fixed_set_dt(filter, filter->fx_dt);
+#else
+    const mat4 R = {
+        {(kf_scalar)meas_err_us_x / KALMAN_MICRO, 0, 0, 0},
+        {0, (kf_scalar)meas_err_us_y / KALMAN_MICRO, 0, 0},
+        {0, 0, (kf_scalar)meas_err_rssi_x / KALMAN_MICRO, 0},
+        {0, 0, 0, (kf_scalar)meas_err_rssi_y / KALMAN_MICRO}};
+    double noise = (double)proc_err / KALMAN_MICRO;
+
+    if (filter->proc_err == noise
+            && memcmp(R, filter->R, sizeof(mat4)) == 0) {
+        return;
+    }
+    filter->proc_err = noise;
+    mat4_identity(filter->Q);
+    mat4_scale(filter->Q, noise * filter->dt);
+    mat4_copy(filter->R, R);
+    steady_gain_reset(filter);
+#endif
+}
+
+/*
+* init_kalman()
+* initialise a kalman filter stuct. The initial state (um, um/s), its
+* variance init_err and the noise settings are in micro units and dt is in
+* kernel ticks, so the fixed-point mode is set up without a float.
+* REF: https://thekalmanfilter.com/kalman-filter-explained-simply/
+*/
+void init_kalman(Kalman* filter, int ndim, const int32_t x_init[4], int32_t init_err, int32_t meas_err_rssi_x, int32_t meas_err_rssi_y, int32_t meas_err_us_x, int32_t meas_err_us_y, int32_t proc_err, int64_t dt, int m, int n) 
+{
+#ifndef CONFIG_KALMAN_UPDATE_FIXED
+    vec4 x;
+    mat4 cov_init;
+
+    for (int i = 0; i < 4; i++) {
+        x[i] = (kf_scalar)x_init[i] / KALMAN_MICRO;
+    }
+    mat4_identity(cov_init);
+    mat4_scale(cov_init, (kf_scalar)init_err / KALMAN_MICRO);
+#endif
+    // dimensions of filter (4x4)
+    filter->ndim = ndim;
+
+#ifdef CONFIG_KALMAN_STEADY_STATE
+    memset(filter->gains, 0, sizeof(filter->gains));
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+    // the fixed-point kernel has the model's structure built in, starting
+    // from a zero time step
+    memset(filter->fx_cov, 0, sizeof(filter->fx_cov));
+    for (int i = 0; i < 4; i++) {
+        filter->fx_x[i] = fix16_from_ratio(x_init[i], KALMAN_MICRO);
+        filter->fx_cov[i][i] = fix16_from_ratio(init_err, KALMAN_MICRO);
+    }
+    filter->fx_dt = 0;
+#else
+    // State transition and state-to-measurement matrices from the model,
+    // starting from a zero time step
+    filter->dt = 0;
+    kalman_gen_transition(filter->A, filter->dt);
+    kalman_gen_observation(filter->H);
+
+    // current position
+    memcpy(filter->x_hat, x, sizeof(vec4));
+    // covariance matrix
+#if defined(CONFIG_KALMAN_UPDATE_UD)
+    ud_factor(cov_init, filter->ud);
+#elif defined(CONFIG_KALMAN_UPDATE_DECOUPLED)
+    for (int axis = 0; axis < 2; axis++) {
+        filter->axis_cov[axis][AXIS_PP] = cov_init[axis][axis];
+        filter->axis_cov[axis][AXIS_PV] = cov_init[axis][axis + 2];
+        filter->axis_cov[axis][AXIS_VV] = cov_init[axis + 2][axis + 2];
+    }
+#else
+    mat4_copy(filter->cov, cov_init);
+#endif
+    filter->proc_err = 0;
+    mat4_fill(filter->R, 0);
+#endif
+    // process noise and measurement error matrices
+    kalman_set_noise(filter, meas_err_rssi_x, meas_err_rssi_y, meas_err_us_x,
+        meas_err_us_y, proc_err);
+    kalman_set_dt_ticks(filter, dt);
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+    kalman_set_control(filter, 0, 0);
+#endif
+#ifdef CONFIG_KALMAN_IMM
+    // nodes spend nearly all their time at rest
+    for (int j = 0; j < IMM_MODELS; j++) {
+        memcpy(filter->imm_x[j], x, sizeof(vec4));
+        mat4_copy(filter->imm_cov[j], cov_init);
+    }
+    filter->imm_prob[IMM_STATIONARY] = 1 - CONFIG_KALMAN_IMM_START_PPM / (kf_scalar)1000000;
+    filter->imm_prob[IMM_MOVING] = CONFIG_KALMAN_IMM_START_PPM / (kf_scalar)1000000;
+#endif
+#ifdef CONFIG_KALMAN_STATE_LOG
+    kalman_state(filter, filter->prior_x, filter->prior_cov);
+    filter->prior_dt = 0;
+#endif
+
+    filter->m = m;
+    filter->n = n;
+}
+   
+#ifndef CONFIG_KALMAN_UPDATE_FIXED
+/*
+* gate_factor()
+* innovation gate for one scalar measurement with innovation error,
+* innovation variance s and measurement error r. The squared Mahalanobis
+* distance error^2 / s is compared with the chi-square bound; returns 1 to
+* accept the measurement, 0 to reject it, or (down-weighting) the factor to
+* inflate r by so the measurement lands exactly on the bound.
+*/
+static kf_scalar gate_factor(kf_scalar error, kf_scalar s, kf_scalar r)
+{
+#ifdef CONFIG_KALMAN_GATE
+    kf_scalar bound = CONFIG_KALMAN_GATE_CHI2_MILLI / (kf_scalar)1000;
+    kf_scalar distance = error * error / s;
+
+    if (distance <= bound) {
+        return 1;
+    }
+#ifdef CONFIG_KALMAN_GATE_DOWNWEIGHT
+    // solve error^2 / (s - r + factor * r) = bound for factor
+    return (error * error / bound - (s - r)) / r;
+#else
+    (void)r;
+    return 0;
+#endif
+#else
+    (void)error;
+    (void)s;
+    (void)r;
+    return 1;
+#endif
+}
+#endif
+
+/*
+* predict()
+* propagate the state and covariance one step forward through the model:
+* x_hat = A * x_hat, cov = A * cov * A^T + Q
+*/
+static void predict(Kalman* filter)
+{
+#if defined(CONFIG_KALMAN_UPDATE_DECOUPLED)
+    axis_predict(filter);
+#elif defined(CONFIG_KALMAN_UPDATE_FIXED)
+    fixed_predict(filter);
+#elif defined(CONFIG_KALMAN_UPDATE_GENERATED)
+    kalman_gen_predict(filter->x_hat, filter->cov, filter->Q, filter->dt);
+#else
+    vec4 x_hat_est;
+
+    mat4_vec_mult(filter->A, filter->x_hat, x_hat_est);
+    memcpy(filter->x_hat, x_hat_est, sizeof(vec4));
+
+#if defined(CONFIG_KALMAN_UPDATE_UD)
+    ud_predict(filter);
+#else
+    mat4 tmp;
+
+    mat4_mult_transpose(filter->cov, filter->A, tmp);
+    mat4_mult(filter->A, tmp, filter->cov);
+    mat4_add(filter->cov, filter->Q);
+#endif
+#endif
+#ifdef CONFIG_KALMAN_ACCEL_CONTROL
+    control_predict(filter);
+#endif
+#ifdef CONFIG_KALMAN_STATE_LOG
+    kalman_state(filter, filter->prior_x, filter->prior_cov);
+    filter->prior_dt += (double)filter->dt;
+#endif
+}
+
+#ifdef KALMAN_FULL_COV
+/*
+* update()
+* given an observation with new position and velocity, update state matrices to
+* predict new matrix. All intermediates live on the stack. Each row is gated
+* on its own innovation; returns the rows that failed the gate.
+* REF: csse4011/tracking.py
+*/
+uint8_t update(const vec4 obs, Kalman* filter) 
+{
+    vec4 x_hat_est;
+    vec4 error_x;
+    vec4 K_error_x;
+    mat4 cov_est;
+    mat4 tmp;
+    mat4 error_cov;
+    mat4 inv_error_cov;
+    mat4 K;
+
+    // x_hat_est = A * x_hat, cov_est = A*(cov*A^T) + Q
+    predict(filter);
+    memcpy(x_hat_est, filter->x_hat, sizeof(vec4));
+    mat4_copy(cov_est, filter->cov);
+
+    // error_x 4x1
+    // 4x1 - (4x4 * 4x1)
+    mat4_vec_mult(filter->H, x_hat_est, error_x);
+    vec4_sub(obs, error_x, error_x);
+
+    // error_cov 4x4
+    // (H * cov_est) * H^T + R
+    mat4_mult(filter->H, cov_est, tmp);
+    mat4_mult_transpose(tmp, filter->H, error_cov);
+    mat4_add(error_cov, filter->R);
+
+    uint8_t gated = 0;
+    const kf_scalar (*H)[4] = filter->H;
+    for (int i = 0; i < 4; i++) {
+        filter->innov_var[i] = error_cov[i][i];
+    }
+#ifdef CONFIG_KALMAN_GATE
+    // rows failing the gate are dropped (zero row of H) or have their
+    // measurement error inflated, then error_cov is rebuilt without them
+    mat4 H_gated;
+    mat4 R_gated;
+
+    mat4_copy(H_gated, filter->H);
+    mat4_copy(R_gated, filter->R);
+    for (int i = 0; i < 4; i++) {
+        kf_scalar factor = gate_factor(error_x[i], error_cov[i][i],
+            filter->R[i][i]);
+        if (factor == 1) {
+            continue;
+        }
+        gated |= 1 << i;
+        if (factor == 0) {
+            memset(H_gated[i], 0, sizeof(H_gated[i]));
+        } else {
+            R_gated[i][i] *= factor;
+        }
+    }
+    if (gated) {
+        H = H_gated;
+        mat4_mult(H, cov_est, tmp);
+        mat4_mult_transpose(tmp, H, error_cov);
+        mat4_add(error_cov, R_gated);
+    }
+#endif
+
+    // K 4x4
+    // (cov_est * H^T) * inv(error_cov)
+    if (mat4_inverse(error_cov, inv_error_cov) != 0) {
+        // singular innovation covariance, keep the prediction only
+        return gated;
+    }
+    mat4_mult_transpose(cov_est, H, tmp);
+    mat4_mult(tmp, inv_error_cov, K);
+
+    // x_hat 4x1
+    // 4x1 + (4x4 * 4x1 = 4 * 1)
+    mat4_vec_mult(K, error_x, K_error_x);
+    vec4_add(x_hat_est, K_error_x, filter->x_hat);
+
+    if (filter->ndim > 1) {
+        // 4x4
+        // (I - K * H) * cov_est
+        mat4_mult(K, H, tmp);
+        mat4_identity(error_cov);
+        mat4_sub(error_cov, tmp);
+        mat4_mult(error_cov, cov_est, filter->cov);
+    } else {
+        // ( 4x4 of all ones - K ) * cov_est
+        mat4_fill(error_cov, 1);
+        mat4_sub(error_cov, K);
+        mat4_mult(error_cov, cov_est, filter->cov);
+    }
+    return gated;
+}
+
+/*
+* update_sequential()
+* measurement update for a diagonal R. Each observation row selected in rows
+* (bit i = obs[i]) is fused on its own as a scalar measurement, so there is no
+* innovation covariance to invert. Rows without fresh data are skipped rather
+* than re-fused with a stale value. Returns the rows that failed the gate.
+*/
+uint8_t update_sequential(const vec4 obs, uint8_t rows, Kalman* filter)
+{
+    uint8_t gated = 0;
+
+    predict(filter);
+
+    for (int i = 0; i < 4; i++) {
+        if (!(rows & (1 << i))) {
+            continue;
+        }
+        const kf_scalar* h = filter->H[i];
+        vec4 cov_HT;
+
+        // cov_HT = cov * h^T, innovation variance s = h * cov * h^T + r
+        for (int j = 0; j < 4; j++) {
+            cov_HT[j] = filter->cov[j][0] * h[0] + filter->cov[j][1] * h[1]
+                + filter->cov[j][2] * h[2] + filter->cov[j][3] * h[3];
+        }
+        kf_scalar hPhT = h[0] * cov_HT[0] + h[1] * cov_HT[1]
+            + h[2] * cov_HT[2] + h[3] * cov_HT[3];
+        kf_scalar s = hPhT + filter->R[i][i];
+        if (s <= 0) {
+            continue;
+        }
+        kf_scalar error = obs[i] - (h[0] * filter->x_hat[0]
+            + h[1] * filter->x_hat[1] + h[2] * filter->x_hat[2]
+            + h[3] * filter->x_hat[3]);
+        filter->innov_var[i] = s;
+        filter->innov[i] = error;
+
+        kf_scalar factor = gate_factor(error, s, filter->R[i][i]);
+        if (factor != 1) {
+            gated |= 1 << i;
+            if (factor == 0) {
+                continue;
+            }
+            s = hPhT + filter->R[i][i] * factor;
+        }
+
+        // K = cov_HT / s, x_hat += K * error, cov -= K * (h * cov)
+        for (int j = 0; j < 4; j++) {
+            kf_scalar K = cov_HT[j] / s;
+            filter->x_hat[j] += K * error;
+            for (int k = 0; k < 4; k++) {
+                filter->cov[j][k] -= K * cov_HT[k];
+            }
+        }
+    }
+    return gated;
+}
+
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_UD
+/*
+* update_ud()
+* Bierman's measurement update: fuse each observation row in rows as a
+* scalar measurement directly on the UD factors. Returns the rows that
+* failed the gate.
+* REF: Bierman, Factorization Methods for Discrete Sequential Estimation
+*/
+static uint8_t update_ud(const vec4 obs, uint8_t rows, Kalman* filter)
+{
+    kf_scalar* ud = filter->ud;
+    uint8_t gated = 0;
+
+    predict(filter);
+
+    for (int row = 0; row < 4; row++) {
+        if (!(rows & (1 << row))) {
+            continue;
+        }
+        const kf_scalar* h = filter->H[row];
+        kf_scalar r = filter->R[row][row];
+        vec4 f;
+        vec4 v;
+        vec4 b;
+
+        // f = U^T * h, v = D * f, innovation variance s = r + f^T * v
+        kf_scalar s = r;
+        for (int j = 0; j < 4; j++) {
+            f[j] = h[j];
+            for (int i = 0; i < j; i++) {
+                f[j] += ud[UD(i, j)] * h[i];
+            }
+            v[j] = ud[UD(j, j)] * f[j];
+            s += f[j] * v[j];
+        }
+        kf_scalar error = obs[row] - (h[0] * filter->x_hat[0]
+            + h[1] * filter->x_hat[1] + h[2] * filter->x_hat[2]
+            + h[3] * filter->x_hat[3]);
+        filter->innov_var[row] = s;
+
+        kf_scalar factor = gate_factor(error, s, r);
+        if (factor != 1) {
+            gated |= 1 << row;
+            if (factor == 0) {
+                continue;
+            }
+            r *= factor;
+        }
+
+        kf_scalar alpha = r + f[0] * v[0];
+        ud[UD(0, 0)] *= r / alpha;
+        b[0] = v[0];
+        for (int j = 1; j < 4; j++) {
+            kf_scalar alpha_prev = alpha;
+            alpha += f[j] * v[j];
+            kf_scalar lambda = -f[j] / alpha_prev;
+            ud[UD(j, j)] *= alpha_prev / alpha;
+            for (int i = 0; i < j; i++) {
+                kf_scalar u = ud[UD(i, j)];
+                ud[UD(i, j)] = u + lambda * b[i];
+                b[i] += v[j] * u;
+            }
+            b[j] = v[j];
+        }
+
+        // K = b / alpha, x_hat += K * error
+        for (int j = 0; j < 4; j++) {
+            filter->x_hat[j] += b[j] / alpha * error;
+        }
+    }
+    return gated;
+}
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_DECOUPLED
+/*
+* update_decoupled()
+* fuse each observation row in rows as a scalar position measurement of its
+* axis: rows 0 and 2 measure x, rows 1 and 3 measure y (see H in
+* init_kalman()). Returns the rows that failed the gate.
+*/
+static uint8_t update_decoupled(const vec4 obs, uint8_t rows, Kalman* filter)
+{
+    uint8_t gated = 0;
+
+    predict(filter);
+
+    for (int row = 0; row < 4; row++) {
+        if (!(rows & (1 << row))) {
+            continue;
+        }
+        int axis = row & 1;
+        kf_scalar* p = filter->axis_cov[axis];
+        kf_scalar r = filter->R[row][row];
+        kf_scalar s = p[AXIS_PP] + r;
+        kf_scalar error = obs[row] - filter->x_hat[axis];
+        filter->innov_var[row] = s;
+
+        kf_scalar factor = gate_factor(error, s, r);
+        if (factor != 1) {
+            gated |= 1 << row;
+            if (factor == 0) {
+                continue;
+            }
+            s = p[AXIS_PP] + r * factor;
+        }
+
+        // K = [pp pv]^T / s, P -= K * [pp pv]
+        kf_scalar K_p = p[AXIS_PP] / s;
+        kf_scalar K_v = p[AXIS_PV] / s;
+        filter->x_hat[axis] += K_p * error;
+        filter->x_hat[axis + 2] += K_v * error;
+        p[AXIS_VV] -= K_v * p[AXIS_PV];
+        p[AXIS_PV] -= K_p * p[AXIS_PV];
+        p[AXIS_PP] -= K_p * p[AXIS_PP];
+    }
+    return gated;
+}
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_GENERATED
+/*
+* update_generated()
+* sequential scalar update using the unrolled kernel generated from the
+* model description at build time. Returns the rows that failed the gate.
+*/
+static uint8_t update_generated(const vec4 obs, uint8_t rows, Kalman* filter)
+{
+    uint8_t gated = 0;
+
+    predict(filter);
+
+    for (int row = 0; row < 4; row++) {
+        if (!(rows & (1 << row))) {
+            continue;
+        }
+        vec4 cov_HT;
+        kf_scalar hPhT;
+        kf_scalar error = obs[row] - kalman_gen_innovation(row, filter->x_hat,
+            filter->cov, cov_HT, &hPhT);
+        kf_scalar r = filter->R[row][row];
+        kf_scalar s = hPhT + r;
+        if (s <= 0) {
+            continue;
+        }
+        filter->innov_var[row] = s;
+        filter->innov[row] = error;
+
+        kf_scalar factor = gate_factor(error, s, r);
+        if (factor != 1) {
+            gated |= 1 << row;
+            if (factor == 0) {
+                continue;
+            }
+            s = hPhT + r * factor;
+        }
+        kalman_gen_correct(filter->x_hat, filter->cov, cov_HT, error, s);
+    }
+    return gated;
+}
+#endif
+
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+/*
+* gate_fixed()
+* Q16.16 version of gate_factor() for an innovation error with innovation
+* variance *s. Returns 1 to accept, 0 to reject, or -1 when down-weighting,
+* in which case *s is raised so the measurement lands exactly on the bound.
+*/
+static int gate_fixed(fix16 error, fix16* s)
+{
+#ifdef CONFIG_KALMAN_GATE
+    const fix16 bound = (fix16)((int64_t)CONFIG_KALMAN_GATE_CHI2_MILLI * FIX16_ONE / 1000);
+
+    if (fix16_mul_div(error, error, *s) <= bound) {
+        return 1;
+    }
+#ifdef CONFIG_KALMAN_GATE_DOWNWEIGHT
+    // error^2 / s = bound once s is inflated to error^2 / bound
+    *s = fix16_mul_div(error, error, bound);
+    return -1;
+#else
+    return 0;
+#endif
+#else
+    (void)error;
+    (void)s;
+    return 1;
+#endif
+}
+
+/*
+* update_fixed()
+* sequential scalar updates in Q16.16. Each observation row measures one
+* position state directly (rows 0 and 2 x, rows 1 and 3 y, see H in
+* init_kalman()), so h * cov is a column of cov. The gain is never rounded
+* on its own: each product with it is a single multiply-divide by s. Returns
+* the rows that failed the gate.
+*/
+static uint8_t update_fixed(const kalman_obs obs, uint8_t rows, Kalman* filter)
+{
+    uint8_t gated = 0;
+    fix16 (*P)[4] = filter->fx_cov;
+
+    predict(filter);
+
+    for (int row = 0; row < 4; row++) {
+        if (!(rows & (1 << row))) {
+            continue;
+        }
+        int state = row & 1;
+        fix16 cov_HT[4];
+
+        for (int j = 0; j < 4; j++) {
+            cov_HT[j] = P[j][state];
+        }
+        fix16 s = fix16_add(cov_HT[state], filter->fx_r[row]);
+        if (s <= 0) {
+            continue;
+        }
+        fix16 error = fix16_sub(obs[row], filter->fx_x[state]);
+
+        int gate = gate_fixed(error, &s);
+        if (gate != 1) {
+            gated |= 1 << row;
+            if (gate == 0) {
+                continue;
+            }
+        }
+
+        // x_hat += cov_HT * error / s, cov -= cov_HT * cov_HT^T / s
+        for (int j = 0; j < 4; j++) {
+            filter->fx_x[j] = fix16_add(filter->fx_x[j],
+                fix16_mul_div(cov_HT[j], error, s));
+            for (int k = j; k < 4; k++) {
+                P[j][k] = fix16_sub(P[j][k],
+                    fix16_mul_div(cov_HT[j], cov_HT[k], s));
+                P[k][j] = P[j][k];
+            }
+        }
+        // rounding must not leave a variance at or below zero
+        for (int j = 0; j < 4; j++) {
+            if (P[j][j] < 1) {
+                P[j][j] = 1;
+            }
+        }
+    }
+    return gated;
+}
+#endif
+
+#ifdef CONFIG_KALMAN_STEADY_STATE
+/*
+* steady_gain_slot()
+* find the cached gain for a set of fused rows, claiming a free slot the first
+* time a set is seen. Returns NULL if every slot is taken by other sets.
+*/
+static struct steady_gain* steady_gain_slot(Kalman* filter, uint8_t rows)
+{
+    struct steady_gain* unused = NULL;
+
+    for (int i = 0; i < STEADY_GAIN_SLOTS; i++) {
+        if (filter->gains[i].rows == rows) {
+            return &filter->gains[i];
+        }
+        if (filter->gains[i].rows == 0 && unused == NULL) {
+            unused = &filter->gains[i];
+        }
+    }
+    if (unused != NULL) {
+        unused->rows = rows;
+        unused->stable = 0;
+        unused->locked = false;
+        // force the first comparison to fail
+        mat4_fill(unused->cov, 0);
+    }
+    return unused;
+}
+
+/*
+* steady_gain_track()
+* after a full update, compare filter->cov with the covariance left by the
+* previous update of the same rows. Once it has changed by less than the
+* tolerance for enough consecutive updates, lock in the gain
+* K = cov * H^T * R^-1 (columns of the fused rows only, valid as R is
+* diagonal).
+*/
+static void steady_gain_track(Kalman* filter, struct steady_gain* gain)
+{
+    kf_scalar max_cov = 0;
+    kf_scalar max_diff = 0;
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            kf_scalar value = filter->cov[i][j];
+            kf_scalar diff = value - gain->cov[i][j];
+            value = (value < 0) ? -value : value;
+            diff = (diff < 0) ? -diff : diff;
+            max_cov = (value > max_cov) ? value : max_cov;
+            max_diff = (diff > max_diff) ? diff : max_diff;
+        }
+    }
+    mat4_copy(gain->cov, filter->cov);
+#ifdef CONFIG_KALMAN_STATE_LOG
+    mat4_copy(gain->prior_cov, filter->prior_cov);
+#endif
+
+    if (max_diff * 1000000 > max_cov * CONFIG_KALMAN_STEADY_STATE_TOLERANCE_PPM) {
+        gain->stable = 0;
+        return;
+    }
+    if (++gain->stable < CONFIG_KALMAN_STEADY_STATE_COUNT) {
+        return;
+    }
+
+    for (int col = 0; col < 4; col++) {
+        bool fused = gain->rows & (1 << col);
+        for (int row = 0; row < 4; row++) {
+            kf_scalar cov_HT = 0;
+            for (int k = 0; k < 4; k++) {
+                cov_HT += filter->cov[row][k] * filter->H[col][k];
+            }
+            gain->K[row][col] = fused ? cov_HT / filter->R[col][col] : 0;
+        }
+    }
+    memcpy(gain->innov_var, filter->innov_var, sizeof(vec4));
+    gain->locked = true;
+}
+
+/*
+* update_steady()
+* predict and correct the state with a locked gain. The covariance is not
+* propagated; it stays at the converged value for those rows, as does the
+* predicted covariance the state log records. Gating uses the
+* converged innovation variances; a down-weighted row has its innovation
+* scaled by the ratio its gain would shrink by. Returns the rows that failed
+* the gate.
+*/
+static uint8_t update_steady(const vec4 obs, const struct steady_gain* gain, Kalman* filter)
+{
+    vec4 x_hat_est;
+    vec4 error_x;
+    uint8_t gated = 0;
+
+    mat4_vec_mult(filter->A, filter->x_hat, x_hat_est);
+#ifdef CONFIG_KALMAN_STATE_LOG
+    // the prediction converged along with the update
+    memcpy(filter->prior_x, x_hat_est, sizeof(vec4));
+    mat4_copy(filter->prior_cov, gain->prior_cov);
+    filter->prior_dt += (double)filter->dt;
+#endif
+    mat4_vec_mult(filter->H, x_hat_est, error_x);
+    for (int i = 0; i < 4; i++) {
+        if (!(gain->rows & (1 << i))) {
+            error_x[i] = 0;
+            continue;
+        }
+        error_x[i] = obs[i] - error_x[i];
+
+        kf_scalar factor = gate_factor(error_x[i], gain->innov_var[i],
+            filter->R[i][i]);
+        if (factor != 1) {
+            gated |= 1 << i;
+            kf_scalar s = gain->innov_var[i];
+            error_x[i] *= (factor == 0) ? 0
+                : s / (s + (factor - 1) * filter->R[i][i]);
+        }
+    }
+    mat4_vec_mult(gain->K, error_x, filter->x_hat);
+    vec4_add(x_hat_est, filter->x_hat, filter->x_hat);
+    mat4_copy(filter->cov, gain->cov);
+    return gated;
+}
+#endif
+
+/*
+* filter_predict()
+* propagate the filter forward one step without a measurement. Any
+* steady-state gain assumed exactly one prediction per update, so it is
+* dropped and re-learned.
+*/
+static void filter_predict(Kalman* filter)
+{
+    predict(filter);
+    steady_gain_reset(filter);
+}
+
+/*
+* filter_step()
+* run one predict/update cycle for the observation rows set in rows. Once the
+* covariance for those rows has converged, the cached steady-state gain is
+* used instead of propagating the covariance. Returns the rows rejected or
+* down-weighted by the innovation gate.
+*/
+static uint8_t filter_step(const kalman_obs obs, uint8_t rows, Kalman* filter)
+{
+    uint8_t gated;
+
+#ifdef CONFIG_KALMAN_STEADY_STATE
+#ifdef CONFIG_KALMAN_UPDATE_FULL
+    // the full update fuses every row whether it is fresh or not
+    rows = OBS_ALL;
+#endif
+    struct steady_gain* gain = steady_gain_slot(filter, rows);
+
+    if (gain != NULL && gain->locked) {
+        return update_steady(obs, gain, filter);
+    }
+#endif
+
+#if defined(CONFIG_KALMAN_UPDATE_SEQUENTIAL)
+    gated = update_sequential(obs, rows, filter);
+#elif defined(CONFIG_KALMAN_UPDATE_UD)
+    gated = update_ud(obs, rows, filter);
+#elif defined(CONFIG_KALMAN_UPDATE_DECOUPLED)
+    gated = update_decoupled(obs, rows, filter);
+#elif defined(CONFIG_KALMAN_UPDATE_GENERATED)
+    gated = update_generated(obs, rows, filter);
+#elif defined(CONFIG_KALMAN_UPDATE_FIXED)
+    gated = update_fixed(obs, rows, filter);
+#else
+    (void)rows;
+    gated = update(obs, filter);
+#endif
+
+#ifdef CONFIG_KALMAN_STEADY_STATE
+    if (gain != NULL) {
+        steady_gain_track(filter, gain);
+    }
+#endif
+    return gated;
+}
+
+#ifdef CONFIG_KALMAN_IMM
+/*
+* imm_transition()
+* probability of switching from model from to model to between steps.
+*/
+static kf_scalar imm_transition(int from, int to)
+{
+    kf_scalar leave = (from == IMM_STATIONARY)
+        ? CONFIG_KALMAN_IMM_START_PPM / (kf_scalar)1000000
+        : CONFIG_KALMAN_IMM_STOP_PPM / (kf_scalar)1000000;
+
+    return (from == to) ? 1 - leave : leave;
+}
+
+/*
+* imm_combine()
+* moment-matched mixture of the model estimates with the given weights:
+* x = sum(w_i * x_i), cov = sum(w_i * (cov_i + (x_i - x) * (x_i - x)^T)).
+*/
+static void imm_combine(const Kalman* filter, const kf_scalar* weight, vec4 x, mat4 cov)
+{
+    memset(x, 0, sizeof(vec4));
+    for (int i = 0; i < IMM_MODELS; i++) {
+        for (int k = 0; k < 4; k++) {
+            x[k] += weight[i] * filter->imm_x[i][k];
+        }
+    }
+    mat4_fill(cov, 0);
+    for (int i = 0; i < IMM_MODELS; i++) {
+        vec4 d;
+
+        vec4_sub(filter->imm_x[i], x, d);
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 4; k++) {
+                cov[j][k] += weight[i] * (filter->imm_cov[i][j][k] + d[j] * d[k]);
+            }
+        }
+    }
+}
+
+/*
+* imm_mix()
+* interaction step: the starting estimate of each model is the mixture of
+* all the model estimates, weighted by the probability of having been in
+* each model given a switch to this one. Returns the predicted model
+* probabilities in prior.
+*/
+static void imm_mix(Kalman* filter, kf_scalar* prior)
+{
+    vec4 x[IMM_MODELS];
+    mat4 cov[IMM_MODELS];
+
+    for (int j = 0; j < IMM_MODELS; j++) {
+        kf_scalar weight[IMM_MODELS];
+
+        prior[j] = 0;
+        for (int i = 0; i < IMM_MODELS; i++) {
+            weight[i] = imm_transition(i, j) * filter->imm_prob[i];
+            prior[j] += weight[i];
+        }
+        for (int i = 0; i < IMM_MODELS; i++) {
+            weight[i] /= prior[j];
+        }
+        imm_combine(filter, weight, x[j], cov[j]);
+    }
+    for (int j = 0; j < IMM_MODELS; j++) {
+        memcpy(filter->imm_x[j], x[j], sizeof(vec4));
+        mat4_copy(filter->imm_cov[j], cov[j]);
+    }
+}
+
+/*
+* imm_load()
+* make model j the filter's current state: its estimate, covariance, and
+* process noise scaled to the current time step.
+*/
+static void imm_load(Kalman* filter, int j)
+{
+    kf_scalar proc_err = (j == IMM_STATIONARY)
+        ? CONFIG_KALMAN_IMM_STATIONARY_NOISE_PPM / (kf_scalar)1000000
+        : CONFIG_KALMAN_IMM_MOVING_NOISE_PPM / (kf_scalar)1000000;
+
+    memcpy(filter->x_hat, filter->imm_x[j], sizeof(vec4));
+    mat4_copy(filter->cov, filter->imm_cov[j]);
+    mat4_identity(filter->Q);
+    mat4_scale(filter->Q, proc_err * filter->dt);
+}
+
+/*
+* imm_store()
+* save the filter's current state back as model j.
+*/
+static void imm_store(Kalman* filter, int j)
+{
+    memcpy(filter->imm_x[j], filter->x_hat, sizeof(vec4));
+    mat4_copy(filter->imm_cov[j], filter->cov);
+}
+
+/*
+* imm_log_likelihood()
+* log likelihood (up to a constant shared by the models) of the given
+* innovations and innovation variances of the rows in rows.
+*/
+static kf_scalar imm_log_likelihood(const vec4 innov, const vec4 innov_var, uint8_t rows)
+{
+    kf_scalar log_l = 0;
+
+    for (int row = 0; row < 4; row++) {
+        if (rows & (1 << row)) {
+            log_l -= (innov[row] * innov[row] / innov_var[row]
+                + kf_log(innov_var[row])) / 2;
+        }
+    }
+    return log_l;
+}
+
+/*
+* imm_blend()
+* publish the probability-weighted estimate of the models in x_hat and cov.
+*/
+static void imm_blend(Kalman* filter)
+{
+    imm_combine(filter, filter->imm_prob, filter->x_hat, filter->cov);
+}
+
+/*
+* imm_predict()
+* interacting multiple model prediction without a measurement.
+*/
+static void imm_predict(Kalman* filter)
+{
+    kf_scalar prior[IMM_MODELS];
+
+    // with nothing to reweight them by, the predicted probabilities stand
+    imm_mix(filter, prior);
+    memcpy(filter->imm_prob, prior, sizeof(prior));
+    for (int j = 0; j < IMM_MODELS; j++) {
+        imm_load(filter, j);
+        filter_predict(filter);
+        imm_store(filter, j);
+    }
+    imm_blend(filter);
+}
+
+/*
+* imm_step()
+* interacting multiple model cycle: mix the model estimates, run the
+* predict/update of each model, then reweight the models by how well each
+* predicted the measurement. Returns the rows gated by every model.
+*/
+static uint8_t imm_step(const vec4 obs, uint8_t rows, Kalman* filter)
+{
+    kf_scalar prior[IMM_MODELS];
+    kf_scalar log_l[IMM_MODELS];
+    vec4 innov[IMM_MODELS];
+    vec4 innov_var[IMM_MODELS];
+    uint8_t gated = rows;
+
+    imm_mix(filter, prior);
+    for (int j = 0; j < IMM_MODELS; j++) {
+        imm_load(filter, j);
+        gated &= filter_step(obs, rows, filter);
+        memcpy(innov[j], filter->innov, sizeof(vec4));
+        memcpy(innov_var[j], filter->innov_var, sizeof(vec4));
+        imm_store(filter, j);
+    }
+    // a row even the moving model rejects is an outlier, not evidence of
+    // motion, so it is left out of the comparison
+    for (int j = 0; j < IMM_MODELS; j++) {
+        log_l[j] = imm_log_likelihood(innov[j], innov_var[j], rows & ~gated);
+    }
+
+    // posterior probabilities, relative to the best model so kf_exp() cannot
+    // underflow to zero for both
+    kf_scalar best = (log_l[0] > log_l[1]) ? log_l[0] : log_l[1];
+    kf_scalar total = 0;
+    for (int j = 0; j < IMM_MODELS; j++) {
+        filter->imm_prob[j] = prior[j] * kf_exp(log_l[j] - best);
+        total += filter->imm_prob[j];
+    }
+    for (int j = 0; j < IMM_MODELS; j++) {
+        filter->imm_prob[j] /= total;
+    }
+    imm_blend(filter);
+    return gated;
+}
+#endif
+
+/*
+* kalman_predict()
+* propagate the filter forward one step without a measurement.
+*/
+void kalman_predict(Kalman* filter)
+{
+#ifdef CONFIG_KALMAN_IMM
+    imm_predict(filter);
+#else
+    filter_predict(filter);
+#endif
+}
+
+/*
+* kalman_step()
+* run one predict/update cycle for the observation rows set in rows, through
+* the interacting multiple model filter if enabled. Returns the rows rejected
+* or down-weighted by the innovation gate.
+*/
+uint8_t kalman_step(const kalman_obs obs, uint8_t rows, Kalman* filter)
+{
+#ifdef CONFIG_KALMAN_IMM
+    return imm_step(obs, rows, filter);
+#else
+    return filter_step(obs, rows, filter);
+#endif
+}
+
+#ifndef CONFIG_KALMAN_UPDATE_FIXED
+/*
+* kalman_state()
+* copy out the current estimate and its covariance, rebuilding the covariance
+* from whichever form the update mode keeps it in.
+*/
+void kalman_state(const Kalman* filter, vec4 x, mat4 cov)
+{
+#if defined(CONFIG_KALMAN_UPDATE_UD)
+    memcpy(x, filter->x_hat, sizeof(vec4));
+    // cov = U * D * U^T, U unit upper triangular
+    for (int i = 0; i < 4; i++) {
+        for (int j = i; j < 4; j++) {
+            kf_scalar sum = filter->ud[UD(j, j)] * ((i == j) ? 1 : filter->ud[UD(i, j)]);
+            for (int k = j + 1; k < 4; k++) {
+                sum += filter->ud[UD(i, k)] * filter->ud[UD(k, k)] * filter->ud[UD(j, k)];
+            }
+            cov[i][j] = sum;
+            cov[j][i] = sum;
+        }
+    }
+#elif defined(CONFIG_KALMAN_UPDATE_DECOUPLED)
+    memcpy(x, filter->x_hat, sizeof(vec4));
+    mat4_fill(cov, 0);
+    for (int axis = 0; axis < 2; axis++) {
+        cov[axis][axis] = filter->axis_cov[axis][AXIS_PP];
+        cov[axis][axis + 2] = filter->axis_cov[axis][AXIS_PV];
+        cov[axis + 2][axis] = filter->axis_cov[axis][AXIS_PV];
+        cov[axis + 2][axis + 2] = filter->axis_cov[axis][AXIS_VV];
+    }
+#else
+    memcpy(x, filter->x_hat, sizeof(vec4));
+    mat4_copy(cov, filter->cov);
+#endif
+}
+
+/*
+* kalman_estimate()
+* copy out the current estimate (x, y, vx, vy) without its covariance.
+*/
+void kalman_estimate(const Kalman* filter, vec4 x)
+{
+    memcpy(x, filter->x_hat, sizeof(vec4));
+}
+#endif
+
+/*
+* kalman_estimate_milli()
+* current estimate in mm and mm/s, truncated toward zero. The fixed-point
+* mode scales its Q16.16 state with integer arithmetic only.
+*/
+void kalman_estimate_milli(const Kalman* filter, int32_t x[4])
+{
+    for (int i = 0; i < 4; i++) {
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+        x[i] = (int32_t)((int64_t)filter->fx_x[i] * 1000 / FIX16_ONE);
+#else
+        x[i] = (int32_t)(filter->x_hat[i] * 1000);
+#endif
+    }
+}
+
+#ifdef CONFIG_KALMAN_STATE_LOG
+/*
+* kalman_log_get()
+* forward pass record of the last step: the prediction it started from and
+* the updated estimate. The next record's time step counts from here.
+*/
+void kalman_log_get(Kalman* filter, struct kalman_log_record* record)
+{
+    record->dt = filter->prior_dt;
+    memcpy(record->prior_x, filter->prior_x, sizeof(vec4));
+    mat4_copy(record->prior_cov, filter->prior_cov);
+    kalman_state(filter, record->x, record->cov);
+    filter->prior_dt = 0;
+}
+#endif
+
+/*
+* kalman_elapsed_ticks()
+* kernel ticks since *last_ticks, advancing *last_ticks to now. A sample
+* older than the last one fused (from the other fifo) gives 0 rather than
+* predicting backwards.
+*/
+int64_t kalman_elapsed_ticks(int64_t* last_ticks, int64_t now)
+{
+    int64_t ticks = now - *last_ticks;
+
+    if (ticks < 0) {
+        return 0;
+    }
+    *last_ticks = now;
+    return ticks;
+}
+
+/*
+* obs_value()
+* a reading in um as an observation in the arithmetic of the update mode.
+*/
+#ifdef CONFIG_KALMAN_UPDATE_FIXED
+static fix16 obs_value(int32_t um)
+{
+    return fix16_from_ratio(um, KALMAN_MICRO);
+}
+#else
+static kf_scalar obs_value(int32_t um)
+{
+    return (kf_scalar)um / KALMAN_MICRO;
+}
+#endif
+
+/*
+* kalman_observe_init()
+* seed every observation row with a starting position (um) before the first
+* reading arrives. The full update fuses all four rows on each step, so
+* it keeps using these values for the rows no sensor measures.
+*/
+void kalman_observe_init(kalman_obs obs, int32_t x, int32_t y)
+{
+    obs[0] = obs_value(x);
+    obs[1] = obs_value(y);
+    obs[2] = obs_value(x);
+    obs[3] = obs_value(y);
+}
+
+/*
+* kalman_observe()
+* copy a sensor reading (um) into the observation rows fed by its fifo,
+* limiting any values to not be read if outside grid. The ultrasonic sensor
+* only measures x (row 2) and the rssi fifo only y (row 1), so the other
+* value of the reading is ignored. Returns the rows refreshed.
+*/
+uint8_t kalman_observe(int32_t x, int32_t y, bool from_us, kalman_obs obs)
+{
+    uint8_t fresh = 0;
+
+    if (from_us) {
+        if (x <= 4 * KALMAN_MICRO){
+            obs[2] = obs_value(x);
+            fresh |= OBS_US_X;
+        }
+        //printf("us reading: x: %f\n", obs[2]);
+    } else {
+        if (y <= 4 * KALMAN_MICRO){
+            obs[1] = obs_value(y);
+            fresh |= OBS_RS_Y;
+        }
+        //printf("rs reading: y: %f\n", obs[1]);
+    }
+    return fresh;
+}
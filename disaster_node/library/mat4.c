@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include "mat4.h"
+
+/*
+* mat4_print()
+* print each cell of a 4x4 matrix. Used for testing and debugging.
+*/
+void mat4_print(const mat4 a)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            printf("%6.2f ", a[i][j]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+* mat4_identity()
+* overwrite out with the 4x4 identity matrix.
+*/
+void mat4_identity(mat4 out)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            out[i][j] = (i == j) ? 1 : 0;
+        }
+    }
+}
+
+/*
+* mat4_fill()
+* set every cell of out to value.
+*/
+void mat4_fill(mat4 out, kf_scalar value)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            out[i][j] = value;
+        }
+    }
+}
+
+/*
+* mat4_copy()
+* copy the contents of src into dst.
+*/
+void mat4_copy(mat4 dst, const mat4 src)
+{
+    memcpy(dst, src, sizeof(mat4));
+}
+
+/*
+* mat4_mult()
+* out = a * b. out must not alias a or b.
+* REF: https://www.programiz.com/c-programming/examples/matrix-multiplication
+*/
+void mat4_mult(const mat4 a, const mat4 b, mat4 out)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            kf_scalar sum = 0;
+            for (int k = 0; k < 4; k++) {
+                sum += a[i][k] * b[k][j];
+            }
+            out[i][j] = sum;
+        }
+    }
+}
+
+/*
+* mat4_mult_transpose()
+* out = a * b^T, without building the transpose. out must not alias a or b.
+*/
+void mat4_mult_transpose(const mat4 a, const mat4 b, mat4 out)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            kf_scalar sum = 0;
+            for (int k = 0; k < 4; k++) {
+                sum += a[i][k] * b[j][k];
+            }
+            out[i][j] = sum;
+        }
+    }
+}
+
+/*
+* mat4_add()
+* a += b
+*/
+void mat4_add(mat4 a, const mat4 b)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            a[i][j] += b[i][j];
+        }
+    }
+}
+
+/*
+* mat4_sub()
+* a -= b
+*/
+void mat4_sub(mat4 a, const mat4 b)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            a[i][j] -= b[i][j];
+        }
+    }
+}
+
+/*
+* mat4_scale()
+* multiply every cell of a by scaler.
+*/
+void mat4_scale(mat4 a, kf_scalar scaler)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            a[i][j] *= scaler;
+        }
+    }
+}
+
+/*
+* determinant3x3()
+* computes and returns the determinant of a 3x3 matrix gives each cells
+* REF: https://www.semath.info/src/inverse-cofactor-ex4.html
+*/
+static kf_scalar determinant3x3(kf_scalar a, kf_scalar b, kf_scalar c,
+        kf_scalar d, kf_scalar e, kf_scalar f, kf_scalar g, kf_scalar h,
+        kf_scalar i)
+{
+    return (a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g));
+}
+
+/*
+* minor3x3()
+* determinant of the 3x3 matrix left after removing row skip_row and column
+* skip_col from a. Indexes the 4x4 directly instead of copying out the 3x3.
+*/
+static kf_scalar minor3x3(const mat4 a, int skip_row, int skip_col)
+{
+    int r[3];
+    int c[3];
+
+    for (int i = 0, k = 0; i < 4; i++) {
+        if (i != skip_row) {
+            r[k++] = i;
+        }
+    }
+    for (int j = 0, k = 0; j < 4; j++) {
+        if (j != skip_col) {
+            c[k++] = j;
+        }
+    }
+
+    return determinant3x3(
+        a[r[0]][c[0]], a[r[0]][c[1]], a[r[0]][c[2]],
+        a[r[1]][c[0]], a[r[1]][c[1]], a[r[1]][c[2]],
+        a[r[2]][c[0]], a[r[2]][c[1]], a[r[2]][c[2]]);
+}
+
+/*
+* mat4_inverse()
+* given a 4x4 matrix, compute its inverse by cofactor expansion. Each of the
+* 16 cofactors is computed once and reused for the determinant (expansion
+* along row 0).
+* REF: https://www.semath.info/src/inverse-cofactor-ex4.html
+*/
+int mat4_inverse(const mat4 a, mat4 out)
+{
+    mat4 cofactor;
+
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            kf_scalar minor = minor3x3(a, row, col);
+            cofactor[row][col] = ((row + col) & 1) ? -minor : minor;
+        }
+    }
+
+    kf_scalar det = 0;
+    for (int i = 0; i < 4; i++) {
+        det += a[0][i] * cofactor[0][i];
+    }
+    if (det == 0) {
+        return -1;
+    }
+
+    // inverse is the transposed cofactor matrix (adjugate) over determinant
+    kf_scalar inv_det = 1 / det;
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            out[col][row] = cofactor[row][col] * inv_det;
+        }
+    }
+    return 0;
+}
+
+/*
+* mat4_vec_mult()
+* out = a * v. out must not alias v.
+*/
+void mat4_vec_mult(const mat4 a, const vec4 v, vec4 out)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = a[i][0] * v[0] + a[i][1] * v[1] + a[i][2] * v[2]
+            + a[i][3] * v[3];
+    }
+}
+
+/*
+* vec4_add()
+* out = a + b
+*/
+void vec4_add(const vec4 a, const vec4 b, vec4 out)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = a[i] + b[i];
+    }
+}
+
+/*
+* vec4_sub()
+* out = a - b
+*/
+void vec4_sub(const vec4 a, const vec4 b, vec4 out)
+{
+    for (int i = 0; i < 4; i++) {
+        out[i] = a[i] - b[i];
+    }
+}
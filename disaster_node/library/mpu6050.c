@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "mpu6050.h"
+
+// sample rate of the accelerometer path with the low pass filter on
+#define MPU6050_BASE_RATE_HZ 1000
+
+/*
+* dlpf_for_rate()
+* widest digital low pass filter setting (CONFIG register) whose bandwidth
+* stays under half the sample rate, so the samples are not aliased.
+*/
+static uint8_t dlpf_for_rate(uint32_t rate_hz)
+{
+    // accelerometer bandwidth (Hz) of DLPF_CFG 1..6
+    static const uint16_t bandwidth[] = {184, 94, 44, 21, 10, 5};
+
+    for (int i = 0; i < ARRAY_SIZE(bandwidth); i++) {
+        if (bandwidth[i] * 2 <= rate_hz) {
+            return i + 1;
+        }
+    }
+    return ARRAY_SIZE(bandwidth);
+}
+
+/*
+* mpu6050_fifo_reset()
+* empty the FIFO and keep it enabled.
+*/
+static int mpu6050_fifo_reset(const struct i2c_dt_spec* bus)
+{
+    int rc = i2c_reg_write_byte_dt(bus, MPU6050_USER_CTRL, MPU6050_USER_CTRL_FIFO_RESET);
+
+    if (rc == 0) {
+        rc = i2c_reg_write_byte_dt(bus, MPU6050_USER_CTRL, MPU6050_USER_CTRL_FIFO_EN);
+    }
+    return rc;
+}
+
+/*
+* mpu6050_fifo_start()
+* run the accelerometer alone at +-2 g, filtered for and sampled at about
+* rate_hz, into the FIFO. The gyros are put in standby, which also moves the
+* clock to the internal oscillator. Writes the exact sample period to
+* *period_us. Returns 0 or the I2C error.
+*/
+int mpu6050_fifo_start(const struct i2c_dt_spec* bus, uint32_t rate_hz, uint32_t* period_us)
+{
+    uint32_t divider = MPU6050_BASE_RATE_HZ / CLAMP(rate_hz, 4, MPU6050_BASE_RATE_HZ);
+    const uint8_t setup[][2] = {
+        {MPU6050_PWR_MGMT_1, 0},
+        {MPU6050_PWR_MGMT_2, MPU6050_PWR_MGMT_2_STBY_GYRO},
+        {MPU6050_CONFIG, dlpf_for_rate(MPU6050_BASE_RATE_HZ / divider)},
+        {MPU6050_SMPLRT_DIV, divider - 1},
+        {MPU6050_ACCEL_CONFIG, 0},
+        // samples are read on a timer, not on an interrupt
+        {MPU6050_INT_ENABLE, 0},
+        {MPU6050_FIFO_EN, MPU6050_FIFO_EN_ACCEL},
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(setup); i++) {
+        int rc = i2c_reg_write_byte_dt(bus, setup[i][0], setup[i][1]);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    *period_us = divider * (USEC_PER_SEC / MPU6050_BASE_RATE_HZ);
+    return mpu6050_fifo_reset(bus);
+}
+
+/*
+* mpu6050_fifo_read()
+* read up to max accelerometer samples from the FIFO in a single I2C burst,
+* straight into xyz, and write the number still queued to *pending. Returns
+* the samples read, or -EOVERFLOW if the FIFO had filled (samples were lost
+* and it has been emptied), or another negative I2C error.
+*/
+int mpu6050_fifo_read(const struct i2c_dt_spec* bus, int16_t (*xyz)[3], int max, int* pending)
+{
+    uint8_t count_be[2];
+    int rc = i2c_burst_read_dt(bus, MPU6050_FIFO_COUNTH, count_be, sizeof(count_be));
+
+    *pending = 0;
+    if (rc != 0) {
+        return rc;
+    }
+    uint16_t bytes = sys_get_be16(count_be);
+
+    // a full or misaligned FIFO has dropped samples, start again
+    if (bytes >= MPU6050_FIFO_SIZE || bytes % MPU6050_FIFO_SAMPLE_SIZE) {
+        rc = mpu6050_fifo_reset(bus);
+        return (rc != 0) ? rc : -EOVERFLOW;
+    }
+    int available = bytes / MPU6050_FIFO_SAMPLE_SIZE;
+    int count = MIN(available, max);
+
+    if (count == 0) {
+        return 0;
+    }
+    // the FIFO holds big-endian x, y, z per sample, the layout of xyz
+    rc = i2c_burst_read_dt(bus, MPU6050_FIFO_R_W, (uint8_t*)xyz, count * MPU6050_FIFO_SAMPLE_SIZE);
+    if (rc != 0) {
+        return rc;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            xyz[i][axis] = (int16_t)sys_be16_to_cpu((uint16_t)xyz[i][axis]);
+        }
+    }
+    *pending = available - count;
+    return count;
+}
+
+/*
+* lp_wake_for_rate()
+* slowest cycle mode wake-up rate (LP_WAKE_CTRL: 1.25, 5, 20 or 40 Hz) at
+* least wake_hz, or 40 Hz if wake_hz is above them all.
+*/
+static uint8_t lp_wake_for_rate(uint32_t wake_hz)
+{
+    // wake-up rates of LP_WAKE_CTRL 0..2, rounded up to whole Hz
+    static const uint8_t rate[] = {2, 5, 20};
+
+    for (int i = 0; i < ARRAY_SIZE(rate); i++) {
+        if (wake_hz <= rate[i]) {
+            return i;
+        }
+    }
+    return ARRAY_SIZE(rate);
+}
+
+/*
+* mpu6050_motion_arm()
+* stop the FIFO and put the accelerometer into low power cycle mode, waking
+* for one sample at about wake_hz, with the gyros and temperature sensor
+* off. The motion interrupt is armed to latch INT high once the
+* acceleration has differed from its value now by more than threshold_mg
+* for duration_ms. Must be called while the part is sampling, as after
+* mpu6050_fifo_start(), so the reference sample is taken at full rate.
+* Returns 0 or the I2C error.
+* REF: MPU-6000/MPU-6050 Register Map and Descriptions, rev 3.2, motion
+* detection and low power accelerometer mode
+*/
+int mpu6050_motion_arm(const struct i2c_dt_spec* bus, uint32_t threshold_mg, uint32_t duration_ms,
+    uint32_t wake_hz)
+{
+    const uint8_t setup[][2] = {
+        {MPU6050_FIFO_EN, 0},
+        {MPU6050_USER_CTRL, 0},
+        // +-2 g with the motion high pass filter reset
+        {MPU6050_ACCEL_CONFIG, 0},
+        {MPU6050_INT_PIN_CFG, MPU6050_INT_PIN_CFG_LATCH},
+        {MPU6050_MOT_THR, CLAMP(threshold_mg / MPU6050_MOT_THR_MG, 1, 255)},
+        {MPU6050_MOT_DUR, CLAMP(duration_ms, 1, 255)},
+        {MPU6050_INT_ENABLE, MPU6050_INT_MOT},
+    };
+    uint8_t status;
+    int rc;
+
+    for (int i = 0; i < ARRAY_SIZE(setup); i++) {
+        rc = i2c_reg_write_byte_dt(bus, setup[i][0], setup[i][1]);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    // let a sample through the reset filter, then hold it as the reference
+    k_msleep(2);
+    rc = i2c_reg_write_byte_dt(bus, MPU6050_ACCEL_CONFIG, MPU6050_ACCEL_CONFIG_HPF_HOLD);
+    if (rc == 0) {
+        // drop an interrupt latched while the detector settled
+        rc = mpu6050_motion_clear(bus, &status);
+    }
+    if (rc == 0) {
+        rc = i2c_reg_write_byte_dt(bus, MPU6050_PWR_MGMT_2,
+            (lp_wake_for_rate(wake_hz) << MPU6050_PWR_MGMT_2_LP_WAKE_SHIFT) | MPU6050_PWR_MGMT_2_STBY_GYRO);
+    }
+    if (rc == 0) {
+        rc = i2c_reg_write_byte_dt(bus, MPU6050_PWR_MGMT_1,
+            MPU6050_PWR_MGMT_1_CYCLE | MPU6050_PWR_MGMT_1_TEMP_DIS);
+    }
+    return rc;
+}
+
+/*
+* mpu6050_motion_clear()
+* read INT_STATUS into *status, which also releases a latched INT pin.
+* Returns 0 or the I2C error.
+*/
+int mpu6050_motion_clear(const struct i2c_dt_spec* bus, uint8_t* status)
+{
+    return i2c_reg_read_byte_dt(bus, MPU6050_INT_STATUS, status);
+}
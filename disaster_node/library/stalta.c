@@ -0,0 +1,77 @@
+#include <string.h>
+#include "stalta.h"
+
+/*
+* stalta_init()
+* reset a detector. It does not trigger until the LTA window is full.
+*/
+void stalta_init(struct stalta* detector)
+{
+    memset(detector, 0, sizeof(*detector));
+}
+
+/*
+* characteristic()
+* squared change between two samples, saturated to 32 bits.
+*/
+static uint32_t characteristic(int32_t sample, int32_t last)
+{
+    int64_t change = (int64_t)sample - last;
+    uint64_t energy = (uint64_t)(change * change);
+
+    return (energy > UINT32_MAX) ? UINT32_MAX : (uint32_t)energy;
+}
+
+/*
+* lta_mean_scaled()
+* the LTA denominator of the ratio scaled by STA_SAMPLES * LTA_SAMPLES, so
+* the ratio compares without division. The mean is held at least at
+* CONFIG_STALTA_FLOOR so a perfectly still sensor does not trigger on its
+* first flicker.
+*/
+static uint64_t lta_mean_scaled(const struct stalta* detector)
+{
+    uint64_t floor = (uint64_t)CONFIG_STALTA_FLOOR * STALTA_LTA_SAMPLES;
+    uint64_t lta = (detector->lta_sum > floor) ? detector->lta_sum : floor;
+
+    return lta * STALTA_STA_SAMPLES;
+}
+
+/*
+* stalta_update()
+* feed one sample: slide both windows along the ring by one and test the
+* ratio against the trigger or, once triggered, the detrigger threshold.
+*/
+enum stalta_event stalta_update(struct stalta* detector, int32_t sample)
+{
+    // the first sample has no change to measure
+    uint32_t energy = (detector->count == 0) ? 0 : characteristic(sample, detector->last);
+    uint16_t head = detector->head;
+    uint16_t sta_tail = (head + STALTA_LTA_SAMPLES - STALTA_STA_SAMPLES) % STALTA_LTA_SAMPLES;
+
+    detector->last = sample;
+    // the slot being overwritten leaves the LTA window and the one
+    // STA_SAMPLES back leaves the STA window; both are zero until filled
+    detector->lta_sum += energy - (uint64_t)detector->ring[head];
+    detector->sta_sum += energy - (uint64_t)detector->ring[sta_tail];
+    detector->ring[head] = energy;
+    detector->head = (head + 1) % STALTA_LTA_SAMPLES;
+
+    if (detector->count < STALTA_LTA_SAMPLES) {
+        detector->count++;
+        return STALTA_NONE;
+    }
+
+    uint64_t sta = detector->sta_sum * STALTA_LTA_SAMPLES * 1000;
+    uint64_t lta = lta_mean_scaled(detector);
+
+    if (!detector->triggered && sta >= lta * CONFIG_STALTA_TRIGGER_MILLI) {
+        detector->triggered = true;
+        return STALTA_TRIGGER;
+    }
+    if (detector->triggered && sta < lta * CONFIG_STALTA_DETRIGGER_MILLI) {
+        detector->triggered = false;
+        return STALTA_DETRIGGER;
+    }
+    return STALTA_NONE;
+}
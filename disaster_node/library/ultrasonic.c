@@ -5,10 +5,19 @@
 #include <zephyr/sys/util.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/device.h>
+#ifdef CONFIG_ULTRASONIC_TIMED
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/atomic.h>
+#endif
 #include <stdio.h>
 
 #include "kalman.h"
+#include "kalman_core.h"
 #include "ultrasonic.h"
+#include "stalta.h"
+#ifdef CONFIG_CAPTURE
+#include "capture.h"
+#endif
 
 #define DEBUG_INFO 0
  
@@ -24,37 +33,82 @@ struct hcsr04_fixture {
 
 #define HCSR04_1_NODE DT_ALIAS(hcsr041)
 #define HCSR04_2_NODE DT_ALIAS(hcsr04)
+
+// readings beyond this are missed echoes, not movement
+#define SEISMIC_MAX_DISTANCE_M 4
+
+// STA/LTA trigger of each sensor, and how many of them are triggered
+static struct stalta detectors[2];
+static int detectors_triggered;
  
 void ultrasonic();
 
-static void update_adv_data(struct hcsr04_fixture fixture, int flag) 
+/*
+* seismic_check()
+* run a distance through its sensor's STA/LTA trigger. The alarm is raised
+* when the first sensor triggers and re-armed once every sensor has
+* detriggered, so each new event raises it again.
+*/
+static void seismic_check(int flag, double distance)
 {
-    int err;
+    if (distance > SEISMIC_MAX_DISTANCE_M) {
+        return;
+    }
+    // in mm, about the resolution of the HC-SR04
+    switch (stalta_update(&detectors[flag - 1], (int32_t)(distance * 1000))) {
+    case STALTA_TRIGGER:
+        if (detectors_triggered++ == 0) {
+            printf("!!!!!!!!!EARTHQUAKE!!!!!!!!!\n");
+            k_sem_give(&signal);
+#ifdef CONFIG_CAPTURE
+            capture_trigger();
+#endif
+        }
+        break;
+    case STALTA_DETRIGGER:
+        detectors_triggered--;
+        break;
+    default:
+        break;
+    }
+}
 
+/*
+* publish_distance()
+* hand a distance from sensor flag, measured at timestamp, to the event
+* capture, the STA/LTA trigger and the kalman filter.
+*/
+static void publish_distance(int flag, int64_t timestamp, const struct sensor_value* value)
+{
 	struct kalman_values tx_data;
 
-    /* Fetch sensor sample. */
-    struct sensor_value value;
-    sensor_sample_fetch(fixture.dev);
-    sensor_channel_get(fixture.dev, SENSOR_CHAN_DISTANCE, &value);
+    tx_data.timestamp = timestamp;
+#ifdef CONFIG_CAPTURE
+    capture_add(tx_data.timestamp, CAPTURE_RANGE, flag, value->val1 * 1000 + value->val2 / 1000, 0, 0);
+#endif
     
     /* Report values. Send any measurements if they fit within the protocol. */
     /* Else, wait for the next advertisement interval. */
     //printk("Measured distance: %d.%06d meters\n", value.val1, value.val2);
 
-    size_t size = sizeof(struct us_values);
+    size_t size = sizeof(struct kalman_values);
     char *mem_ptr = k_malloc(size);
 
-    double double_value = sensor_value_to_double(&value);
+    double double_value = sensor_value_to_double(value);
+    // detect on the raw readings rather than waiting for the filter
+    seismic_check(flag, double_value);
+
+    int32_t um = value->val1 * KALMAN_MICRO + value->val2;
+
     if (flag == 1) {
-        tx_data.x = double_value;
+        tx_data.x = um;
         tx_data.y = 0;
         tx_data.vx = 0;
         tx_data.vy = 0;
         tx_data.sensor = flag;
     } else {
         tx_data.x = 0;
-        tx_data.y = double_value;
+        tx_data.y = um;
         tx_data.vx = 0;
         tx_data.vy = 0;
         tx_data.sensor = flag;
@@ -63,14 +117,177 @@ static void update_adv_data(struct hcsr04_fixture fixture, int flag)
     memcpy(mem_ptr, &tx_data, size);
 
     if (flag == 1){
-        k_fifo_put(&kalman_us_fifo, mem_ptr);	
+        kalman_put(&kalman_us_fifo, (struct kalman_values*)mem_ptr);
     } else {
-        k_fifo_put(&kalman_rs_fifo, mem_ptr);
+        kalman_put(&kalman_rs_fifo, (struct kalman_values*)mem_ptr);
     }
     //k_free(mem_ptr);			
 }
 
+#ifndef CONFIG_ULTRASONIC_TIMED
+static void update_adv_data(struct hcsr04_fixture fixture, int flag) 
+{
+    /* Fetch sensor sample. */
+    struct sensor_value value;
+    sensor_sample_fetch(fixture.dev);
+    int64_t timestamp = k_uptime_ticks();
+    sensor_channel_get(fixture.dev, SENSOR_CHAN_DISTANCE, &value);
+
+    publish_distance(flag, timestamp, &value);
+}
+#else
+// speed of sound at 20 C, in mm per ms (= m/s)
+#define SPEED_OF_SOUND 343
+// width of the HC-SR04 trigger pulse; the timer ending it rounds it up to a
+// whole tick, and the sensor only needs it to be at least 10 us
+#define TRIGGER_PULSE_US 10
+
+// one sensor's pins and the echo being timed on them
+struct ping_sensor {
+        struct gpio_dt_spec trigger;
+        struct gpio_dt_spec echo;
+        struct gpio_callback callback;
+        int flag;                     // sensor number passed on with its readings
+        int64_t timestamp;            // k_uptime_ticks() of the latest ping
+        uint32_t rise;                // k_cycle_get_32() at the echo's rising edge
+        bool rising;                  // the echo is high and being timed
+};
+
+// an echo width timed by the interrupts, for the sensor thread
+struct echo {
+        int64_t timestamp;
+        uint32_t width_us;
+        int flag;
+};
+
+static struct ping_sensor sensors[] = {
+    {
+        .trigger = GPIO_DT_SPEC_GET(HCSR04_1_NODE, trigger_gpios),
+        .echo = GPIO_DT_SPEC_GET(HCSR04_1_NODE, echo_gpios),
+        .flag = 1,
+    },
+    {
+        .trigger = GPIO_DT_SPEC_GET(HCSR04_2_NODE, trigger_gpios),
+        .echo = GPIO_DT_SPEC_GET(HCSR04_2_NODE, echo_gpios),
+        .flag = 2,
+    },
+};
+// sensor pinged in the current slot; only its echo is timed
+static atomic_t active;
+static struct k_timer ping_timer;
+static struct k_timer pulse_timer;
+K_MSGQ_DEFINE(echo_msgq, sizeof(struct echo), 2 * ARRAY_SIZE(sensors), 8);
+
+/*
+* echo_isr()
+* time the echo pulse of the active sensor between its edges. A pulse that
+* has not ended by the next slot is dropped by ping_expiry(), so an echo
+* taking longer than a slot never reaches the filter.
+*/
+static void echo_isr(const struct device* port, struct gpio_callback* callback, uint32_t pins)
+{
+    struct ping_sensor* sensor = CONTAINER_OF(callback, struct ping_sensor, callback);
+    uint32_t now = k_cycle_get_32();
+
+    if (sensor != &sensors[atomic_get(&active)]) {
+        return;
+    }
+    if (gpio_pin_get_dt(&sensor->echo) > 0) {
+        sensor->rise = now;
+        sensor->rising = true;
+    } else if (sensor->rising) {
+        struct echo echo = {
+            .timestamp = sensor->timestamp,
+            .width_us = k_cyc_to_us_floor32(now - sensor->rise),
+            .flag = sensor->flag,
+        };
+        sensor->rising = false;
+        k_msgq_put(&echo_msgq, &echo, K_NO_WAIT);
+    }
+}
+
+/*
+* ping_expiry()
+* timer slot handler: ping the next sensor in turn. The sensors alternate
+* in slots of half the ping period, so each echo has a whole slot to return
+* before the other sensor pings and they never sound at once. The trigger
+* pulse is ended by pulse_expiry() rather than waited out in the interrupt.
+*/
+static void ping_expiry(struct k_timer* timer)
+{
+    int next = (atomic_get(&active) + 1) % ARRAY_SIZE(sensors);
+    struct ping_sensor* sensor = &sensors[next];
+
+    // an echo still high from the last slot is out of range
+    sensors[atomic_get(&active)].rising = false;
+    atomic_set(&active, next);
+
+    sensor->timestamp = k_uptime_ticks();
+    gpio_pin_set_dt(&sensor->trigger, 1);
+    k_timer_start(&pulse_timer, K_USEC(TRIGGER_PULSE_US), K_NO_WAIT);
+}
+
+/*
+* pulse_expiry()
+* one-shot timer handler: end the trigger pulse of the sensor pinged last.
+* The sensor sends its burst on the falling edge.
+*/
+static void pulse_expiry(struct k_timer* timer)
+{
+    gpio_pin_set_dt(&sensors[atomic_get(&active)].trigger, 0);
+}
+
+/*
+* ultrasonic_timed()
+* ping the sensors from a kernel timer and time their echoes with GPIO
+* interrupts, so the thread only wakes to publish a reading and the CPU can
+* sleep between edges. Each sensor pings CONFIG_ULTRASONIC_RATE_HZ times a
+* second, staggered half a period apart.
+*/
+static void ultrasonic_timed(void)
+{
+    const k_timeout_t slot = K_USEC(USEC_PER_SEC / (CONFIG_ULTRASONIC_RATE_HZ * ARRAY_SIZE(sensors)));
+    struct echo echo;
+
+    for (int i = 0; i < ARRAY_SIZE(sensors); i++) {
+        struct ping_sensor* sensor = &sensors[i];
+
+        if (!gpio_is_ready_dt(&sensor->trigger) || !gpio_is_ready_dt(&sensor->echo)
+            || gpio_pin_configure_dt(&sensor->trigger, GPIO_OUTPUT_INACTIVE) != 0
+            || gpio_pin_configure_dt(&sensor->echo, GPIO_INPUT) != 0
+            || gpio_pin_interrupt_configure_dt(&sensor->echo, GPIO_INT_EDGE_BOTH) != 0) {
+            printf("HC-SR04 %d pin setup failed\n", sensor->flag);
+            return;
+        }
+        gpio_init_callback(&sensor->callback, echo_isr, BIT(sensor->echo.pin));
+        gpio_add_callback(sensor->echo.port, &sensor->callback);
+    }
+    k_timer_init(&pulse_timer, pulse_expiry, NULL);
+    k_timer_init(&ping_timer, ping_expiry, NULL);
+    k_timer_start(&ping_timer, slot, slot);
+
+    while (1) {
+        k_msgq_get(&echo_msgq, &echo, K_FOREVER);
+        // the round trip, in mm
+        uint32_t distance = echo.width_us * SPEED_OF_SOUND / 2000;
+        struct sensor_value value = {
+            .val1 = distance / 1000,
+            .val2 = distance % 1000 * 1000,
+        };
+        publish_distance(echo.flag, echo.timestamp, &value);
+    }
+}
+#endif
+
 void ultrasonic() {
+    for (int i = 0; i < ARRAY_SIZE(detectors); i++) {
+        stalta_init(&detectors[i]);
+    }
+
+    k_msleep(2000);
+#ifdef CONFIG_ULTRASONIC_TIMED
+    ultrasonic_timed();
+#else
     static struct hcsr04_fixture fixture = {
         .dev = DEVICE_DT_GET(HCSR04_1_NODE),
     };
@@ -79,7 +296,6 @@ void ultrasonic() {
         .dev = DEVICE_DT_GET(HCSR04_2_NODE),
     };
 
-    k_msleep(2000);
     while (1) {
         // Send LE BT advertisement at a fixed interval.
         update_adv_data(fixture, 1);
@@ -87,4 +303,5 @@ void ultrasonic() {
         update_adv_data(fixture2, 2);
         k_sleep(K_MSEC(ADV_INTERVAL_MS));
     }
-}
\ No newline at end of file
+#endif
+}
@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+"""
+Generate the Kalman model setup and an unrolled predict/update kernel from a
+model description.
+
+Usage: gen_kalman.py <model.json> <output.c>
+
+The model gives A and H as matrices of numbers or parameter names, and the
+sparsity pattern of Q and R. The only parameter is "dt": kalman_core.c calls
+the generated functions with the filter's time step and nothing else. Products are expanded
+symbolically at build time so structural zeros and multiplies by one never
+reach the compiled code. The covariance is symmetric, so only its upper
+triangle is computed and then mirrored.
+
+The output implements the functions declared in include/kalman_gen.h.
+init_kalman() and kalman_set_dt() load A and H through the generated model
+setup in every update mode, so the model file is the one description of them.
+The kernel only supports the sequential scalar update, so R must be diagonal;
+other models should use the generic update in kalman_core.c.
+"""
+
+import json
+import sys
+from fractions import Fraction
+
+DIM = 4  # kalman.c stores the filter in mat4/vec4
+
+
+class Expr:
+    """Linear combination of variables with symbolic coefficients.
+
+    terms maps (variable, parameters) to a numeric coefficient, where
+    variable is a C lvalue such as "P[0][2]" and parameters is a sorted
+    tuple of parameter names multiplied together.
+    """
+
+    def __init__(self, terms=None):
+        self.terms = dict(terms or {})
+
+    @staticmethod
+    def var(name):
+        return Expr({(name, ()): Fraction(1)})
+
+    def add(self, other):
+        terms = dict(self.terms)
+        for key, coef in other.terms.items():
+            terms[key] = terms.get(key, 0) + coef
+            if terms[key] == 0:
+                del terms[key]
+        return Expr(terms)
+
+    def scale(self, coef):
+        """Multiply by a model entry: a number or a parameter name."""
+        if isinstance(coef, str):
+            return Expr({(var, tuple(sorted(params + (coef,)))): num
+                         for (var, params), num in self.terms.items()})
+        if coef == 0:
+            return Expr()
+        return Expr({key: num * Fraction(coef)
+                     for key, num in self.terms.items()})
+
+    def is_var(self, name):
+        return self.terms == {(name, ()): 1}
+
+    def c(self):
+        if not self.terms:
+            return "0"
+        out = ""
+        for (var, params), num in sorted(self.terms.items()):
+            factors = list(params) + [var]
+            mag = abs(num)
+            if mag != 1:
+                factors.insert(0, c_number(mag))
+            term = " * ".join(factors)
+            if not out:
+                out = ("-" if num < 0 else "") + term
+            else:
+                out += (" - " if num < 0 else " + ") + term
+        return out
+
+
+def c_number(num):
+    if num.denominator == 1:
+        return str(num.numerator)
+    return "(kf_scalar){}".format(float(num))
+
+
+def c_value(value):
+    """C for a model entry: a parameter name or a number."""
+    if isinstance(value, str):
+        return value
+    if value < 0:
+        return "-" + c_number(-value)
+    return c_number(value)
+
+
+def entry(value, params):
+    if isinstance(value, str):
+        if value not in params:
+            sys.exit("gen_kalman: unknown parameter '{}'".format(value))
+        return value
+    return Fraction(value).limit_denominator()
+
+
+def load(path):
+    with open(path) as f:
+        model = json.load(f)
+
+    if len(model["states"]) != DIM:
+        sys.exit("gen_kalman: model must have {} states".format(DIM))
+    params = model.get("params", [])
+    if params != ["dt"]:
+        sys.exit("gen_kalman: params must be [\"dt\"], kalman_core.c only "
+                 "passes the time step")
+    A = [[entry(v, params) for v in row] for row in model["A"]]
+    H = [[entry(v, []) for v in row] for row in model["H"]]
+    Q = model["Q"]
+    R = model["R"]
+    if len(H) != DIM:
+        sys.exit("gen_kalman: model must have {} observation rows".format(DIM))
+    for i in range(DIM):
+        for j in range(DIM):
+            if i != j and R[i][j]:
+                sys.exit("gen_kalman: R must be diagonal for the "
+                         "sequential update, use the generic update")
+    return params, A, H, Q
+
+
+def P(i, j):
+    # covariance is symmetric, always read the upper triangle
+    return "P[{}][{}]".format(min(i, j), max(i, j))
+
+
+def gen_model(params, A, H):
+    args = "".join(", kf_scalar {}".format(p) for p in params)
+    used = {v for row in A for v in row if isinstance(v, str)}
+    lines = ["void kalman_gen_transition(kf_scalar A[4][4]{})".format(args),
+             "{"]
+    lines += ["    (void){};".format(p) for p in params if p not in used]
+    for i in range(DIM):
+        lines.append("    " + " ".join(
+            "A[{}][{}] = {};".format(i, j, c_value(A[i][j]))
+            for j in range(DIM)))
+    lines += ["}", "",
+              "void kalman_gen_observation(kf_scalar H[4][4])",
+              "{"]
+    for i in range(DIM):
+        lines.append("    " + " ".join(
+            "H[{}][{}] = {};".format(i, j, c_value(H[i][j]))
+            for j in range(DIM)))
+    return lines + ["}"]
+
+
+def gen_predict(params, A, Q):
+    lines = []
+    # x = A * x
+    x_new = []
+    for i in range(DIM):
+        e = Expr()
+        for k in range(DIM):
+            e = e.add(Expr.var("x[{}]".format(k)).scale(A[i][k]))
+        x_new.append(e)
+
+    # T = A * P, P = T * A^T + Q (upper triangle)
+    T = [[Expr() for _ in range(DIM)] for _ in range(DIM)]
+    for i in range(DIM):
+        for j in range(DIM):
+            for k in range(DIM):
+                T[i][j] = T[i][j].add(Expr.var(P(k, j)).scale(A[i][k]))
+    P_new = {}
+    for i in range(DIM):
+        for j in range(i, DIM):
+            e = Expr()
+            for k in range(DIM):
+                e = e.add(T[i][k].scale(A[j][k]))
+            if Q[i][j] or Q[j][i]:
+                e = e.add(Expr.var("Q[{}][{}]".format(i, j)))
+            P_new[(i, j)] = e
+
+    for i, e in enumerate(x_new):
+        if not e.is_var("x[{}]".format(i)):
+            lines.append("    kf_scalar x{} = {};".format(i, e.c()))
+    for (i, j), e in P_new.items():
+        if not e.is_var(P(i, j)):
+            lines.append("    kf_scalar p{}{} = {};".format(i, j, e.c()))
+    lines.append("")
+    for i, e in enumerate(x_new):
+        if not e.is_var("x[{}]".format(i)):
+            lines.append("    x[{0}] = x{0};".format(i))
+    for (i, j), e in P_new.items():
+        if not e.is_var(P(i, j)):
+            if i == j:
+                lines.append("    P[{0}][{0}] = p{0}{0};".format(i))
+            else:
+                lines.append("    P[{0}][{1}] = P[{1}][{0}] = p{0}{1};"
+                             .format(i, j))
+
+    args = "".join(", kf_scalar {}".format(p) for p in params)
+    used = set()
+    for e in x_new + list(P_new.values()):
+        for (_, ps) in e.terms:
+            used.update(ps)
+    unused = ["    (void){};".format(p) for p in params if p not in used]
+    return ["void kalman_gen_predict(kf_scalar x[4], kf_scalar P[4][4], "
+            "const kf_scalar Q[4][4]{})".format(args), "{"] + unused + \
+        lines + ["}"]
+
+
+def gen_innovation(H):
+    lines = ["kf_scalar kalman_gen_innovation(int row, const kf_scalar x[4], "
+             "const kf_scalar P[4][4],",
+             "        kf_scalar PHT[4], kf_scalar* hPhT)",
+             "{",
+             "    switch (row) {"]
+    for row in range(DIM):
+        h = H[row]
+        lines.append("    case {}:".format(row))
+        PHT = []
+        for j in range(DIM):
+            e = Expr()
+            for k in range(DIM):
+                e = e.add(Expr.var(P(j, k)).scale(h[k]))
+            PHT.append(e)
+            lines.append("        PHT[{}] = {};".format(j, e.c()))
+        hPhT = Expr()
+        hx = Expr()
+        for k in range(DIM):
+            hPhT = hPhT.add(Expr.var("PHT[{}]".format(k)).scale(h[k]))
+            hx = hx.add(Expr.var("x[{}]".format(k)).scale(h[k]))
+        lines.append("        *hPhT = {};".format(hPhT.c()))
+        lines.append("        return {};".format(hx.c()))
+    lines += ["    default:",
+              "        *hPhT = 0;",
+              "        return 0;",
+              "    }",
+              "}"]
+    return lines
+
+
+def gen_correct():
+    lines = ["void kalman_gen_correct(kf_scalar x[4], kf_scalar P[4][4], "
+             "const kf_scalar PHT[4],",
+             "        kf_scalar error, kf_scalar s)",
+             "{"]
+    for j in range(DIM):
+        lines.append("    kf_scalar K{0} = PHT[{0}] / s;".format(j))
+    lines.append("")
+    for j in range(DIM):
+        lines.append("    x[{0}] += K{0} * error;".format(j))
+    for i in range(DIM):
+        for j in range(i, DIM):
+            if i == j:
+                lines.append("    P[{0}][{0}] -= K{0} * PHT[{0}];".format(i))
+            else:
+                lines.append("    P[{0}][{1}] = P[{1}][{0}] = P[{0}][{1}] "
+                             "- K{0} * PHT[{1}];".format(i, j))
+    lines.append("}")
+    return lines
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    params, A, H, Q = load(sys.argv[1])
+
+    out = ["/* Generated by scripts/gen_kalman.py from {} - do not edit. */"
+           .format(sys.argv[1].replace("\\", "/").split("/")[-1]),
+           "",
+           '#include "mat4.h"',
+           '#include "kalman_gen.h"',
+           ""]
+    out += gen_model(params, A, H) + [""]
+    out += gen_predict(params, A, Q) + [""]
+    out += gen_innovation(H) + [""]
+    out += gen_correct()
+
+    with open(sys.argv[2], "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
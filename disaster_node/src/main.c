@@ -22,8 +22,11 @@
 // thread memory space
 K_THREAD_STACK_DEFINE(stack_area, 1024*2);
 K_THREAD_STACK_DEFINE(stack_area1, 1024*3);
-K_THREAD_STACK_DEFINE(stack_area2, 1024*2);
+K_THREAD_STACK_DEFINE(stack_area2, 1024*3); // kalman: matrix temporaries live on the stack
 K_THREAD_STACK_DEFINE(stack_area3, 1024*3);
+#ifdef CONFIG_ACCEL
+K_THREAD_STACK_DEFINE(stack_area4, 1024*2);
+#endif
 
 // threads and thread ids
 struct k_thread observer_thread;
@@ -31,6 +34,9 @@ struct k_thread rssi_thread;
 struct k_thread kalman_thread;
 struct k_thread us_thread;
 struct k_thread gui_thread;
+#ifdef CONFIG_ACCEL
+struct k_thread accel_thread;
+#endif
 
 
 k_tid_t observer_tid;
@@ -38,14 +44,24 @@ k_tid_t rssi_tid;
 k_tid_t kalman_tid;
 k_tid_t us_tid;
 k_tid_t gui_tid;
+#ifdef CONFIG_ACCEL
+k_tid_t accel_tid;
+#endif
 
 struct k_fifo ble_fifo;
 
 #include "ultrasonic.h"
 #include "kalman.h"
 #include "gps.h"
+#ifdef CONFIG_ACCEL
+#include "accel.h"
+#endif
 
 #define OFFSET 5
+// payload byte telling the gateway what an advert is
+#define AD_KIND 4
+#define AD_KIND_IDLE 0x01
+#define AD_KIND_ALARM 0xA1
 
 /*
  * Set iBeacon demo advertisement data. These values are for
@@ -60,7 +76,7 @@ struct k_fifo ble_fifo;
  static uint8_t ad_payload[25] = {
     0x95, 0x12,                        // Manufactuer ID: 0x0059 (Nordic Semi)
     0x02, 0x15,               // Custom ID.
-    0x01,                              // Sequence counter. 
+    AD_KIND_IDLE,                      // Advert kind, AD_KIND_ALARM while alarmed
     0xF4, 0x01, 0x04, 0x05, 0x06,      // PADDING
     0x08, 0x07, 0x06      ,            // ULTRASONIC VALUES (meters, millimeter high, millimeter low)
     0x00, 0x00, 0x00, 0x00, 0x00,       // PADDING
@@ -178,14 +194,13 @@ static void update_adv_data(struct gps_values* rx_data) {
     }
     printf("success\n");
 
-    /* Restart advertising. */
+    /* Restart advertising, marked as an alarm for the gateway. */
+    ad_payload[AD_KIND] = AD_KIND_ALARM;
     bt_le_adv_start(BT_LE_ADV_NCONN, ad, ARRAY_SIZE(ad), NULL, 0);
     k_free(rx_data);
     k_msleep(5000);
     bt_le_adv_stop();    
-    while(1){
-        k_msleep(100000);
-    }
+    ad_payload[AD_KIND] = AD_KIND_IDLE;
 }
 
 int main(void)
@@ -213,6 +228,12 @@ int main(void)
 	us_tid = k_thread_create(&us_thread, stack_area3,
 	    K_THREAD_STACK_SIZEOF(stack_area3), ultrasonic,
 	    NULL, NULL, NULL, MY_PRIORITY, 0, K_NO_WAIT);
+#ifdef CONFIG_ACCEL
+	// sample the accelerometer, feeding the kalman filter if enabled
+	accel_tid = k_thread_create(&accel_thread, stack_area4,
+	    K_THREAD_STACK_SIZEOF(stack_area4), accelerometer,
+	    NULL, NULL, NULL, MY_PRIORITY, 0, K_NO_WAIT);
+#endif
 
     struct gps_values* rx_data;
     int flag = 0;
@@ -253,6 +274,8 @@ int gps_test_thread(void)
         //printf("GPS Coordinates (%d Sources): %.6f, %.6f\n", status, latitude, longitude);
         if (k_sem_take(&signal, K_MSEC(50)) != 0) {
             //printk("Input data not available!");
+        } else if (!k_fifo_is_empty(&ble_fifo)) {
+            // the previous alarm is still waiting to be advertised
         } else {
             /* fetch available data */
             
@@ -262,8 +285,10 @@ int gps_test_thread(void)
 
             size_t size = sizeof(struct gps_values);
             char *mem_ptr = k_malloc(size);
-            memcpy(mem_ptr, &tx_data, size);
-            k_fifo_put(&ble_fifo, mem_ptr);
+            if (mem_ptr != NULL) {
+                memcpy(mem_ptr, &tx_data, size);
+                k_fifo_put(&ble_fifo, mem_ptr);
+            }
         }
 
 
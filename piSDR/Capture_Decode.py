@@ -0,0 +1,107 @@
+"""
+Decoder for disaster node event captures.
+
+A node built with CONFIG_CAPTURE_DUMP prints each captured event as
+
+    cap,begin
+    cap,<hex bytes of the blob>
+    ...
+    cap,end
+
+where the blob is a struct capture_header followed by its records, oldest
+first, little-endian (see disaster_node/include/capture.h). Other console
+output in the log is ignored, and every complete event in it is decoded.
+
+usage: python3 Capture_Decode.py <node log> <output prefix>
+
+Each event is written to <output prefix>_<n>.csv with one line per record:
+time relative to the trigger (s), kind, source and the three values, in
+the units of the kind (mm, mm/s^2 or mm/s).
+"""
+import sys
+import struct
+import numpy as np
+
+MAGIC = 0x50435145
+VERSION = 1
+HEADER = struct.Struct("<qIHHIIII")
+RECORD = np.dtype([("ticks", "<u4"), ("kind", "u1"), ("source", "u1"), ("value", "<i2", 3)])
+KINDS = ["range", "accel", "position", "velocity"]
+
+
+def read_blobs(lines):
+    # bytes of every complete cap,begin .. cap,end block
+    blob = None
+    for line in lines:
+        line = line.strip()
+        if line == "cap,begin":
+            blob = bytearray()
+        elif line == "cap,end" and blob is not None:
+            yield bytes(blob)
+            blob = None
+        elif line.startswith("cap,") and blob is not None:
+            try:
+                blob += bytes.fromhex(line[4:])
+            except ValueError:
+                # a garbled line loses the whole event
+                blob = None
+
+
+def decode(blob):
+    # (header fields, records) of one blob, or None if it is not a capture
+    if len(blob) < HEADER.size:
+        return None
+    (triggerTicks, magic, version, recordSize, ticksPerSec,
+     count, trigger, decimation) = HEADER.unpack_from(blob)
+    if magic != MAGIC or version != VERSION or recordSize != RECORD.itemsize:
+        return None
+    if len(blob) != HEADER.size + count * recordSize:
+        return None
+    records = np.frombuffer(blob, RECORD, count, HEADER.size)
+    header = {"trigger_ticks": triggerTicks, "ticks_per_sec": ticksPerSec,
+              "trigger": trigger, "accel_decimation": decimation}
+    return header, records
+
+
+def relative_times(header, records):
+    # seconds from the trigger; ticks are the low 32 bits, so they are
+    # unwrapped against the trigger time, which is within half a wrap
+    offset = (records["ticks"].astype(np.int64) - header["trigger_ticks"]) % (1 << 32)
+    offset = np.where(offset >= 1 << 31, offset - (1 << 32), offset)
+    return offset / header["ticks_per_sec"]
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("Usage: python3 Capture_Decode.py <node log> <output prefix>")
+        sys.exit(1)
+    logPath = sys.argv[1]
+    prefix = sys.argv[2]
+
+    with open(logPath, errors="replace") as log:
+        blobs = list(read_blobs(log))
+    events = 0
+    for blob in blobs:
+        decoded = decode(blob)
+        if decoded is None:
+            print("Skipping a capture that did not decode")
+            continue
+        header, records = decoded
+        times = relative_times(header, records)
+        outPath = f"{prefix}_{events}.csv"
+        with open(outPath, "w") as out:
+            out.write("time,kind,source,v0,v1,v2\n")
+            for time, record in zip(times, records):
+                kind = KINDS[record["kind"]] if record["kind"] < len(KINDS) else str(record["kind"])
+                v0, v1, v2 = record["value"]
+                out.write(f"{time:.6f},{kind},{record['source']},{v0},{v1},{v2}\n")
+        print(f"Event {events}: {len(records)} records, "
+              f"{len(records) - header['trigger']} after the trigger, into {outPath}")
+        events += 1
+    if events == 0:
+        print("No captures in " + logPath)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,87 @@
+"""
+Multi-node consensus for gateway event detection.
+
+Handle_Event.py passes only the adverts a node marks as alarms. One noisy
+node must not start a recording on its own: an alarm is escalated only
+once at least K distinct nodes within about radius metres of it have
+alarmed in the last window seconds.
+
+Nodes are bucketed into a grid of radius-sized cells by position. Each
+cell keeps its alarms in arrival order, plus the latest alarm time of each
+node in it, so expiring old alarms is amortized O(1) and the distinct
+nodes of a cell are just the size of that map. A node is held in the map
+of the cell of its latest alarm only, so one whose position jitters across
+a cell boundary still counts once. A node's neighbourhood is
+its cell and the 8 around it, so each advert touches a fixed 9 cells
+whatever the number of nodes or alarms. The neighbourhood reaches between
+radius and 2 * sqrt(2) * radius from the node.
+
+After escalating, a neighbourhood is held off for cooldown seconds so the
+continuing adverts of the same event do not escalate it again.
+"""
+import math
+from collections import deque
+
+# metres per degree of latitude
+METRES_PER_DEGREE = 111320.0
+
+
+class Cell:
+    # alarms of the nodes in one grid cell
+    def __init__(self):
+        self.alarms = deque()  # (time, node), oldest first
+        self.latest = {}       # node -> time of its latest alarm
+        self.escalated = -math.inf
+
+    def expire(self, before):
+        # forget alarms older than before
+        while self.alarms and self.alarms[0][0] < before:
+            time, node = self.alarms.popleft()
+            if self.latest.get(node) == time:
+                del self.latest[node]
+
+
+class Consensus:
+    def __init__(self, k=2, window=10.0, radius=500.0, cooldown=60.0):
+        self.k = k
+        self.window = window
+        self.radius = radius
+        self.cooldown = cooldown
+        self.cells = {}
+        self.node_cell = {}  # node -> cell of its latest alarm
+
+    def cell_of(self, latitude, longitude):
+        # grid cell of a position, longitude scaled for its latitude
+        y = latitude * METRES_PER_DEGREE
+        x = longitude * METRES_PER_DEGREE * math.cos(math.radians(latitude))
+        return (math.floor(x / self.radius), math.floor(y / self.radius))
+
+    def alarm(self, node, latitude, longitude, now):
+        """
+        Record an alarm from node at (latitude, longitude) at time now
+        (seconds, non-decreasing). Returns the number of distinct nodes
+        alarmed in its neighbourhood within the window if that reaches K
+        and the neighbourhood is not held off, else 0.
+        """
+        cx, cy = self.cell_of(latitude, longitude)
+        own = self.cells.setdefault((cx, cy), Cell())
+        previous = self.node_cell.get(node)
+        if previous is not None and previous is not own:
+            # moved: its older alarms in the previous cell no longer count
+            previous.latest.pop(node, None)
+        self.node_cell[node] = own
+        own.alarms.append((now, node))
+        own.latest[node] = now
+
+        neighbours = [self.cells.get((cx + dx, cy + dy))
+                      for dx in (-1, 0, 1) for dy in (-1, 0, 1)]
+        neighbours = [cell for cell in neighbours if cell is not None]
+        agreeing = 0
+        for cell in neighbours:
+            cell.expire(now - self.window)
+            agreeing += len(cell.latest)
+        if agreeing < self.k or now - own.escalated < self.cooldown:
+            return 0
+        for cell in neighbours:
+            cell.escalated = now
+        return agreeing
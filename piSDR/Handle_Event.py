@@ -6,6 +6,7 @@ import signal
 import subprocess
 import asyncio
 from bleak import BleakScanner
+from Consensus import Consensus
 
 piURL = 'https://api.us-e1.tago.io/data'
 piHeaderGET = {
@@ -91,8 +92,18 @@ def emergency_apis():
 
 
 ble_id = 0x1295
+# advert kind byte (after the company id) of a node that has alarmed, see
+# AD_KIND in disaster_node/src/main.c; the node also advertises when idle
+ad_kind = 2
+ad_kind_alarm = 0xA1
 device_queue = asyncio.Queue()
 
+# escalate only when this many nodes alarm within the window and radius
+consensus_nodes = 2
+consensus_window_s = 10
+consensus_radius_m = 500
+consensus = Consensus(consensus_nodes, consensus_window_s, consensus_radius_m)
+
 def convert_to_coords(payload):
     latInt = payload[6:8]
     latDec = payload[8:14]
@@ -104,8 +115,8 @@ def convert_to_coords(payload):
 
 def detection_callback(device, advertisement_data):
     for company_id, data in advertisement_data.manufacturer_data.items():
-        if company_id == ble_id:
-            asyncio.create_task(device_queue.put(data.hex()))
+        if company_id == ble_id and len(data) > ad_kind and data[ad_kind] == ad_kind_alarm:
+            device_queue.put_nowait((device.address, data.hex()))
 
 def run_ble_async(ble_detected_event):
     async def inner():
@@ -113,20 +124,18 @@ def run_ble_async(ble_detected_event):
         scanner.register_detection_callback(detection_callback)
 
         async with scanner:
-            try:
-                result = await asyncio.wait_for(device_queue.get(), timeout=60)  # Optional timeout
+            while not scan_stop_event.is_set():
+                try:
+                    node, result = await asyncio.wait_for(device_queue.get(), timeout=1)
+                except asyncio.TimeoutError:
+                    continue
                 latitude, longitude = convert_to_coords(result)
-                upload_GPS(latitude, longitude)  # Push to tago
-                ble_detected_event.set()  # Signal that BLE was found
-                # Drain remaining queue items (prevents multiple triggers from same event)
-                while not device_queue.empty():
-                    try:
-                        device_queue.get_nowait()
-                    except queue.Empty:
-                        break
-            except asyncio.TimeoutError:
-                #print("BLE scan timed out.")
-                time.sleep(1)
+                # one node alone is not enough, see Consensus.py
+                agreeing = consensus.alarm(node, float(latitude), float(longitude), time.monotonic())
+                if agreeing:
+                    print(f"{agreeing} nodes agree near {latitude}, {longitude}")
+                    upload_GPS(latitude, longitude)  # Push to tago
+                    ble_detected_event.set()  # Signal that BLE was found
 
     asyncio.run(inner())
 
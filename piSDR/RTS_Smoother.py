@@ -0,0 +1,192 @@
+"""
+Rauch-Tung-Striebel smoother for disaster node filter logs.
+
+A node built with CONFIG_KALMAN_STATE_LOG prints one "kf," line per fused
+sample with the forward pass of its kalman filter:
+
+    kf,<time us>,<dt>,<predicted x y vx vy>,<predicted covariance>,
+       <updated x y vx vy>,<updated covariance>
+
+where each covariance is the upper triangle of the 4x4 matrix, row by row,
+and dt is the time predicted over since the previous line. Other console
+output in the log is ignored.
+
+The smoother runs backwards over the forward pass to give the best estimate
+of every state using the samples after it as well as before. Each backward
+step is an affine map of the later smoothed state, so a chunk of steps is
+composed with a vectorized parallel scan instead of a Python loop. Records
+are spooled to a temporary file and processed a chunk at a time from the
+end, so memory stays bounded for logs of any length.
+
+usage: python3 RTS_Smoother.py <node log> <smoothed csv> [chunk]
+
+The output has one line per record: time (s), smoothed x, y, vx, vy and the
+standard deviation of x and y. The peak displacement from the first
+position is printed at the end.
+"""
+import sys
+import os
+import tempfile
+import numpy as np
+
+STATE = 4
+TRIANGLE = np.triu_indices(STATE)
+ESTIMATE_LEN = STATE + len(TRIANGLE[0])
+RECORD_LEN = 2 + 2 * ESTIMATE_LEN
+OUTPUT_LEN = 1 + STATE + 2
+DEFAULT_CHUNK = 65536
+
+
+def parse_line(line):
+    # float fields of one "kf," line, or None if it was garbled
+    try:
+        return [float(value) for value in line.split(',')[1:]]
+    except ValueError:
+        return None
+
+
+def parse_records(lines):
+    # float rows of the "kf," lines, skipping any cut short or garbled
+    lines = [line for line in lines if line.count(',') == RECORD_LEN]
+    if not lines:
+        return np.empty((0, RECORD_LEN))
+    try:
+        return np.loadtxt(lines, delimiter=',', usecols=range(1, RECORD_LEN + 1), ndmin=2)
+    except ValueError:
+        rows = [row for row in map(parse_line, lines) if row is not None]
+        return np.array(rows, dtype=np.float64).reshape(-1, RECORD_LEN)
+
+
+def spool_records(logPath, spool, chunk):
+    # copy the log's records to spool as raw float64 rows, returns the count
+    count = 0
+    with open(logPath, 'r', errors='replace') as log:
+        batch = []
+        for line in log:
+            if line.startswith('kf,'):
+                batch.append(line)
+            if len(batch) == chunk:
+                rows = parse_records(batch)
+                rows.tofile(spool)
+                count += len(rows)
+                batch = []
+        rows = parse_records(batch)
+        rows.tofile(spool)
+        count += len(rows)
+    spool.flush()
+    return count
+
+
+def unpack_covariance(triangle):
+    cov = np.empty((len(triangle), STATE, STATE))
+    cov[:, TRIANGLE[0], TRIANGLE[1]] = triangle
+    cov[:, TRIANGLE[1], TRIANGLE[0]] = triangle
+    return cov
+
+
+def unpack(rows):
+    # time (s), dt, predicted state and covariance, updated state and covariance
+    prior = rows[:, 2:2 + ESTIMATE_LEN]
+    post = rows[:, 2 + ESTIMATE_LEN:]
+    return (rows[:, 0] / 1e6, rows[:, 1],
+            prior[:, :STATE], unpack_covariance(prior[:, STATE:]),
+            post[:, :STATE], unpack_covariance(post[:, STATE:]))
+
+
+def transition(dt):
+    # constant velocity model, state (x, y, vx, vy)
+    F = np.tile(np.eye(STATE), (len(dt), 1, 1))
+    F[:, 0, 2] = dt
+    F[:, 1, 3] = dt
+    return F
+
+
+def suffix_scan(C, b, D):
+    # compose the backward steps k..L-1 for every k in place, doubling the span
+    # each pass: a step maps a later smoothed state s and covariance P to
+    # C s + b and C P C^T + D
+    span = 1
+    while span < len(C):
+        head = C[:-span]
+        b[:-span] = np.einsum('kij,kj->ki', head, b[span:]) + b[:-span]
+        D[:-span] = head @ D[span:] @ head.transpose(0, 2, 1) + D[:-span]
+        C[:-span] = head @ C[span:]
+        span *= 2
+
+
+def smooth(records, out, chunk):
+    # backward pass over records (memmap) into out, a chunk at a time from the end
+    count = len(records)
+    t, dt, prior_x, prior_cov, x, cov = unpack(records[count - 1:count])
+    later_x = x[0]
+    later_cov = cov[0]
+    out[count - 1] = np.concatenate(([t[0]], later_x, np.sqrt(np.diag(later_cov)[:2])))
+
+    end = count - 1
+    while end > 0:
+        start = max(0, end - chunk)
+        t, dt, prior_x, prior_cov, x, cov = unpack(np.asarray(records[start:end + 1]))
+        # gain C = P F^T P_pred^-1 of each step k from the prediction of k + 1
+        F = transition(dt[1:])
+        C = np.linalg.solve(prior_cov[1:], F @ cov[:-1]).transpose(0, 2, 1)
+        b = x[:-1] - np.einsum('kij,kj->ki', C, prior_x[1:])
+        D = cov[:-1] - C @ prior_cov[1:] @ C.transpose(0, 2, 1)
+        suffix_scan(C, b, D)
+
+        smoothed_x = np.einsum('kij,j->ki', C, later_x) + b
+        smoothed_cov = C @ later_cov @ C.transpose(0, 2, 1) + D
+        deviation = np.sqrt(np.maximum(smoothed_cov[:, [0, 1], [0, 1]], 0))
+        out[start:end] = np.column_stack((t[:-1], smoothed_x, deviation))
+        later_x = smoothed_x[0]
+        later_cov = smoothed_cov[0]
+        end = start
+    out.flush()
+
+
+def write_output(out, outPath, chunk):
+    # write the smoothed track as csv, returns (peak displacement, its time)
+    origin = out[0, 1:3]
+    peak = (0.0, out[0, 0])
+    rowFormat = ','.join(['%.6f'] * OUTPUT_LEN) + '\n'
+    with open(outPath, 'w') as f:
+        f.write('time,x,y,vx,vy,sd_x,sd_y\n')
+        for start in range(0, len(out), chunk):
+            rows = np.asarray(out[start:start + chunk])
+            # one format call per chunk, far quicker than np.savetxt's row loop
+            f.write((rowFormat * len(rows)) % tuple(rows.ravel()))
+            displacement = np.hypot(rows[:, 1] - origin[0], rows[:, 2] - origin[1])
+            k = np.argmax(displacement)
+            if displacement[k] > peak[0]:
+                peak = (displacement[k], rows[k, 0])
+    return peak
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print("Usage: python3 RTS_Smoother.py <node log> <smoothed csv> [chunk]")
+        return 1
+    logPath = sys.argv[1]
+    outPath = sys.argv[2]
+    chunk = int(sys.argv[3]) if len(sys.argv) == 4 else DEFAULT_CHUNK
+
+    with tempfile.TemporaryDirectory() as tmp:
+        spoolPath = os.path.join(tmp, 'records.bin')
+        with open(spoolPath, 'wb') as spool:
+            count = spool_records(logPath, spool, chunk)
+        if count == 0:
+            print("No kf records in " + logPath)
+            return 1
+        records = np.memmap(spoolPath, dtype=np.float64, mode='r', shape=(count, RECORD_LEN))
+        out = np.memmap(os.path.join(tmp, 'smoothed.bin'), dtype=np.float64, mode='w+',
+                        shape=(count, OUTPUT_LEN))
+        smooth(records, out, chunk)
+        peak, peakTime = write_output(out, outPath, chunk)
+        del records, out
+
+    print(f"Smoothed {count} records into {outPath}")
+    print(f"Peak displacement: {peak:.4f} m at {peakTime:.3f} s")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())